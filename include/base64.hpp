@@ -0,0 +1,11 @@
+#pragma once
+
+#include <mcap/mcap.hpp>
+
+#include <optional>
+#include <string>
+
+std::string BytesToBase64(const mcap::ByteArray& bytes);
+
+/** Decode a base64 string, returning an empty optional if it is not valid base64 */
+std::optional<mcap::ByteArray> Base64ToBytes(const std::string& base64);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <mcap/mcap.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/** The chunk record `compression` string for `compression`: "", "lz4" or "zstd" */
+std::string CompressionName(mcap::Compression compression);
+
+/**
+ * Decompress the records of `chunk`. On success `records` points to `chunk.uncompressedSize`
+ * bytes, either inside `chunk` itself (uncompressed chunks) or inside `buffer`.
+ */
+mcap::Status DecompressChunk(const mcap::Chunk& chunk, std::vector<std::byte>& buffer,
+                             const std::byte** records);
+
+/**
+ * Compress `size` bytes with "lz4" or "zstd" into `output`. A `level` of 0 selects the default
+ * level of the codec.
+ */
+mcap::Status CompressChunk(const std::string& compression, int level, const std::byte* data,
+                           uint64_t size, std::vector<std::byte>& output);
+
+/**
+ * Read the record starting at `offset` in a buffer of serialized records, e.g. at an offset taken
+ * from a message index. `record->data` points into `data`.
+ */
+mcap::Status RecordAt(const std::byte* data, uint64_t size, uint64_t offset, mcap::Record* record);
+
+/**
+ * Invoke `callback` with each record in a buffer of serialized records (e.g. the decompressed
+ * contents of a chunk) and its offset within the buffer. Stops early if `callback` returns false.
+ */
+mcap::Status ForEachRecord(const std::byte* data, uint64_t size,
+                           const std::function<bool(const mcap::Record&, uint64_t)>& callback);
+
+/**
+ * Read the chunk record located by `chunkIndex`. `chunk->records` points into the read buffer of
+ * `reader` and is only valid until the next read.
+ */
+mcap::Status ReadChunk(mcap::IReadable& reader, const mcap::ChunkIndex& chunkIndex,
+                       mcap::Chunk* chunk);
+
+/** Read the message index records that follow the chunk located by `chunkIndex` */
+mcap::Status ReadMessageIndexes(mcap::IReadable& reader, const mcap::ChunkIndex& chunkIndex,
+                                std::vector<mcap::MessageIndex>& messageIndexes);
@@ -1,5 +1,38 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
-bool Convert(const std::string& inputFilename, const std::string& outputFilename);
+struct ConvertOptions {
+  /** Close the current chunk once it spans this much video time, in nanoseconds, and flush it to
+   * disk. Bounds output latency when converting a live stream. 0 disables time-based chunking. */
+  uint64_t maxChunkDuration = 0;
+  /** If non-empty, also write a keyframe-only preview MCAP to this file from the same demux pass */
+  std::string previewFilename;
+  /** Keep only keyframes in the preview, or in the main output when no preview file is given */
+  bool keyframesOnly = false;
+  /** Maximum frame rate of the preview in Hz, 0 for unlimited. Implies `keyframesOnly` */
+  double maxFps = 0;
+  /** Frame rate used to timestamp images that carry no timestamps of their own (raw MJPEG streams
+   * and image directories whose filenames are not timestamps) */
+  double fps = 30;
+  /** Convert GOP-aligned ranges of an indexed video file (e.g. MP4) concurrently, each with its
+   * own demuxer. Streams and files without a complete index are converted sequentially */
+  bool parallel = false;
+  /** Worker threads for parallel image ingestion and video conversion, 0 for one per hardware
+   * thread */
+  size_t threads = 0;
+  /** When set to true (e.g. by a SIGINT handler), stop reading input and finish the output file */
+  const std::atomic<bool>* interrupt = nullptr;
+};
+
+/**
+ * Convert a video file or stream to `foxglove.CompressedVideo` messages. A directory of images or
+ * an MJPEG stream is converted to `foxglove.CompressedImage` messages instead. Returns false if
+ * the input could not be read completely or an output could not be written, even though the
+ * outputs are still closed as valid (if truncated) files.
+ */
+bool Convert(const std::string& inputFilename, const std::string& outputFilename,
+             const ConvertOptions& options = {});
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+enum class DiffResult {
+  Identical,
+  Different,
+  Error,
+};
+
+struct DiffOptions {
+  /** Worker threads reading and hashing chunks, 0 for one per hardware thread */
+  size_t threads = 0;
+  /** When set to true (e.g. by a SIGINT handler), stop comparing and return an error */
+  const std::atomic<bool>* interrupt = nullptr;
+};
+
+/**
+ * Check whether two inputs hold the same messages per topic: the same log times, publish times and
+ * data, in the same order, regardless of chunking, compression, channel IDs or how topics are
+ * spread over files. Each input is a MCAP file or a `split` output directory, whose *.mcap files
+ * other than index.mcap are read together.
+ *
+ * Messages are compared by 64-bit XXH3 digests computed on a thread pool, and differences are
+ * logged with the first differing message of each topic. A chunk that lines up with a chunk of the
+ * other input and has the same XXH3 hash of its compressed bytes is not decompressed at all.
+ */
+DiffResult Diff(const std::string& pathA, const std::string& pathB,
+                const DiffOptions& options = {});
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum class ExportFormat {
+  Arrow,
+  Parquet,
+};
+
+struct ExportOptions {
+  ExportFormat format = ExportFormat::Parquet;
+  /** Topics to export. Empty exports every protobuf-encoded topic */
+  std::vector<std::string> topics;
+  /** Rows per Parquet row group or Arrow IPC record batch */
+  size_t batchSize = 65536;
+  /** Worker threads decoding chunks, 0 for one per hardware thread */
+  size_t threads = 0;
+  /** When set to true (e.g. by a SIGINT handler), stop reading input and finish the output files */
+  const std::atomic<bool>* interrupt = nullptr;
+};
+
+/**
+ * Export protobuf-encoded topics of a MCAP file to one Arrow IPC (.arrow) or Parquet (.parquet)
+ * file per topic in `outputDir`. Messages are decoded straight from the wire format using the
+ * FileDescriptorSet stored in each schema. Every scalar field, including fields of nested messages,
+ * becomes a column named by its dotted path, and repeated scalar fields become list columns.
+ * Repeated message fields (and maps) are not exported. Each file also has `log_time`,
+ * `publish_time` and `sequence` columns.
+ */
+bool Export(const std::string& inputFilename, const std::string& outputDir,
+            const ExportOptions& options = {});
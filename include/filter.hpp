@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct FilterOptions {
+  /** Predicate over message fields, e.g. `frame_id == "cam_left" && keyframe` */
+  std::string where;
+  /**
+   * Topics to filter. Empty filters every protobuf topic whose schema has the fields referenced by
+   * `where`. Messages of all other topics are dropped
+   */
+  std::vector<std::string> topics;
+  /** Worker threads scanning chunks, 0 for one per hardware thread */
+  size_t threads = 0;
+  /** When set to true (e.g. by a SIGINT handler), stop and close the (incomplete) output file */
+  const std::atomic<bool>* interrupt = nullptr;
+};
+
+/**
+ * Write the messages of protobuf-encoded topics that match `options.where` to a new MCAP file.
+ *
+ * The expression compares dotted field paths (`timestamp.sec`, `frame_id`) with string, number,
+ * `true`/`false` or enum value name literals using `==`, `!=`, `<`, `<=`, `>`, `>=`, and combines
+ * comparisons with `&&`, `||`, `!` and parentheses. A bare path tests a bool field. Fields must be
+ * singular scalars, optionally nested in singular message fields; absent fields compare as their
+ * default value.
+ *
+ * The expression is compiled against each schema's FileDescriptorSet into a wire format scanner
+ * that only decodes the referenced fields and skips over everything else, including large `bytes`
+ * payloads, without deserializing messages. Chunks are scanned in parallel, and chunks whose
+ * messages all match are copied without recompression.
+ */
+bool Filter(const std::string& inputFilename, const std::string& outputFilename,
+            const FilterOptions& options);
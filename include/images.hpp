@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+struct ConvertOptions;
+class VideoSource;
+
+/**
+ * Convert a directory of JPEG/PNG/WebP files to `foxglove.CompressedImage` messages on the "image"
+ * topic. Files are read and serialized on a thread pool and written in timestamp order.
+ */
+bool ConvertImageDirectory(const std::string& inputDir, const std::string& outputFilename,
+                           const ConvertOptions& options);
+
+/**
+ * Convert an MJPEG stream (raw .mjpeg or any container holding MJPEG) to `foxglove.CompressedImage`
+ * messages on the "image" topic.
+ */
+bool ConvertMjpeg(VideoSource& source, const std::string& imageFormat,
+                  const std::string& outputFilename, const ConvertOptions& options);
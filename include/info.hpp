@@ -0,0 +1,12 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <optional>
+#include <string>
+
+/**
+ * Summarize a MCAP file: header, statistics, chunk compression and per-channel message counts.
+ * Returns an empty optional if the file cannot be opened or its summary cannot be read.
+ */
+std::optional<nlohmann::json> Info(const std::string& inputFilename);
@@ -1,12 +1,29 @@
 #pragma once
 
+#include <cstddef>
+#include <memory>
+#include <optional>
 #include <string>
 
 namespace google {
 namespace protobuf {
 class Descriptor;
+class DescriptorPool;
 }  // namespace protobuf
 }  // namespace google
 
-// Returns a serialized google::protobuf::FileDescriptorSet
+// Returns a serialized google::protobuf::FileDescriptorSet. Results are cached per descriptor and
+// this function is thread-safe
 std::string ProtobufFdSet(const google::protobuf::Descriptor* d);
+
+// A message descriptor built at runtime from a MCAP "protobuf" schema, together with the pool that
+// owns it
+struct ProtobufSchema {
+  std::shared_ptr<const google::protobuf::DescriptorPool> pool;
+  const google::protobuf::Descriptor* descriptor = nullptr;
+};
+
+// Builds the descriptor of `messageName` from a serialized FileDescriptorSet, the inverse of
+// ProtobufFdSet(). Returns an empty optional if the set cannot be parsed or lacks the message
+std::optional<ProtobufSchema> LoadProtobufSchema(const std::string& messageName,
+                                                 const std::byte* data, size_t size);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <mcap/mcap.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+struct RecompressOptions {
+  mcap::Compression compression = mcap::Compression::Zstd;
+  /** Codec-specific compression level, 0 for the default of the codec */
+  int compressionLevel = 0;
+  /**
+   * Minimum uncompressed to compressed size ratio for a chunk to be stored compressed. Chunks that
+   * compress worse (e.g. chunks of video or JPEG data) are stored uncompressed
+   */
+  double minRatio = 1.05;
+  /** Worker threads recompressing chunks, 0 for one per hardware thread */
+  size_t threads = 0;
+  /** When set to true (e.g. by a SIGINT handler), stop and close the (incomplete) output file */
+  const std::atomic<bool>* interrupt = nullptr;
+};
+
+/**
+ * Write a copy of a MCAP file with every chunk recompressed, keeping chunk boundaries, message
+ * indexes, schemas, channels, metadata and attachments. Chunks are decompressed and recompressed on
+ * a thread pool and written in order, and the summary section is rebuilt for the new offsets.
+ * Chunks already using the target compression are copied unchanged unless a level is given, and
+ * are stored uncompressed if they do not reach `minRatio` either.
+ */
+bool Recompress(const std::string& inputFilename, const std::string& outputFilename,
+                const RecompressOptions& options);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+struct ServeOptions {
+  /** Path of the Unix domain socket to listen on */
+  std::string socketPath;
+  /** Maximum number of jobs running at once, 0 for one per hardware thread */
+  size_t jobs = 0;
+  /** When set to true, stop accepting jobs, reject queued jobs, let running jobs finish, and
+   * return. Running jobs are not interrupted */
+  const std::atomic<bool>* interrupt = nullptr;
+};
+
+/**
+ * Run a resident job server. Each connection to `options.socketPath` sends one JSON job (within 10
+ * seconds and 64 KiB) and receives one JSON response, both newline-terminated:
+ *
+ *   {"command": "split", "input": "in.mcap", "output": "out_dir"}
+ *   {"command": "convert", "input": "in.mp4", "output": "out.mcap", "maxFps": 1, ...}
+ *   {"command": "info", "input": "in.mcap"}
+ *
+ * Responses hold `ok`, an `error` message on failure, the `result` of `info` jobs, and `stats`
+ * with the wall and CPU time of the job and the size of its output.
+ *
+ * Jobs run with the privileges of the server, so the socket is created with mode 0600 and only
+ * its owner can submit jobs.
+ */
+bool Serve(const ServeOptions& options);
+
+/** Send one JSON job to a running server and print its response. Returns true if the job
+ * succeeded. */
+bool Submit(const std::string& socketPath, const std::string& request);
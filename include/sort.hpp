@@ -0,0 +1,24 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+struct SortOptions {
+  /** Memory for buffering messages before they are spilled to temporary files, in bytes. Peak
+   * memory use is this plus one input chunk and one output chunk, whatever the input size */
+  size_t memoryBudget = size_t(256) * 1024 * 1024;
+  /** Directory for spill files, empty for the system temporary directory */
+  std::string tempDir;
+  /** When set to true (e.g. by a SIGINT handler), stop and close the (incomplete) output file */
+  const std::atomic<bool>* interrupt = nullptr;
+};
+
+/**
+ * Write a copy of a MCAP file with its messages in `logTime` order. Chunks that are internally
+ * sorted and do not overlap any other chunk in time are copied unchanged. The messages of each
+ * group of overlapping chunks are sorted with an external merge sort that spills sorted runs to
+ * temporary files once `memoryBudget` is exhausted.
+ */
+bool Sort(const std::string& inputFilename, const std::string& outputFilename,
+          const SortOptions& options = {});
@@ -1,5 +1,28 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 
-bool Split(const std::string& inputFilename, const std::string& outputDir);
+struct SplitOptions {
+  /** Ignore any checkpoint in the output directory and split the whole input again */
+  bool fresh = false;
+  /** If set, stop reading input once this becomes true and finish the outputs cleanly */
+  const std::atomic<bool>* interrupt = nullptr;
+};
+
+/**
+ * Sanitize a topic name for use as a filename. Strips any leading '/' and replaces all
+ * non-alphanumeric characters with underscores. "index" is reserved for split's index.mcap.
+ */
+std::string TopicFilename(const std::string& topic);
+
+/**
+ * Split a MCAP file into one file per channel plus an index.mcap in `outputDir`.
+ *
+ * Progress is recorded in a checkpoint file in `outputDir`. When the same input is split into the
+ * same directory again, only the data past the checkpoint (records appended to a growing
+ * recording, or the remainder of an interrupted run) is read, and it is appended to the existing
+ * outputs. Only the summary sections of the outputs and index.mcap are rewritten.
+ */
+bool Split(const std::string& inputFilename, const std::string& outputDir,
+           const SplitOptions& options = {});
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+
+struct ThinOptions {
+  /** Maximum message rate in Hz per topic. Messages closer than 1/rate to the last kept message
+   * on their channel are dropped */
+  std::map<std::string, double> rates;
+  /** Keep only every Nth message per topic */
+  std::map<std::string, uint64_t> every;
+  /** When set to true (e.g. by a SIGINT handler), stop and close the (incomplete) output file */
+  const std::atomic<bool>* interrupt = nullptr;
+};
+
+/**
+ * Write a copy of a MCAP file with the topics named in `options` decimated and all other topics
+ * passed through. Messages to keep are selected from the chunk message indexes, so chunks holding
+ * no kept messages are never decompressed and chunks holding only passthrough topics are copied
+ * without decompression.
+ */
+bool Thin(const std::string& inputFilename, const std::string& outputFilename,
+          const ThinOptions& options);
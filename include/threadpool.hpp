@@ -0,0 +1,103 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * A fixed-size pool of worker threads executing tasks in submission order. Results are returned
+ * through futures, so callers that need ordered output can keep a bounded queue of futures and
+ * consume them front to back.
+ */
+class ThreadPool {
+public:
+  /** Start `threadCount` workers. 0 uses one worker per hardware thread. */
+  explicit ThreadPool(size_t threadCount = 0);
+  /** Finish all queued tasks, then join the workers */
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t size() const {
+    return threads_.size();
+  }
+
+  template <typename F>
+  std::future<std::invoke_result_t<F>> submit(F&& task) {
+    using Result = std::invoke_result_t<F>;
+    // std::function requires a copyable target, so the packaged_task is shared
+    auto packagedTask = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+    auto future = packagedTask->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.emplace_back([packagedTask]() {
+        (*packagedTask)();
+      });
+    }
+    cv_.notify_one();
+    return future;
+  }
+
+  /** The number of hardware threads, or 1 if it cannot be determined */
+  static size_t HardwareConcurrency();
+
+private:
+  void run();
+
+  std::vector<std::thread> threads_;
+  std::deque<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+};
+
+/**
+ * Runs tasks on a ThreadPool and hands their results to `consume` on the calling thread in
+ * submission order. At most `window` results are in flight: submitting while the window is full
+ * first consumes the oldest result, which bounds memory when tasks produce faster than the caller
+ * consumes.
+ */
+template <typename Result>
+class OrderedResults {
+public:
+  OrderedResults(ThreadPool& pool, size_t window, std::function<void(Result&&)> consume)
+      : pool_(pool)
+      , window_(window > 0 ? window : 1)
+      , consume_(std::move(consume)) {}
+  OrderedResults(const OrderedResults&) = delete;
+  OrderedResults& operator=(const OrderedResults&) = delete;
+
+  template <typename F>
+  void submit(F&& task) {
+    if (pending_.size() >= window_) {
+      consumeNext();
+    }
+    pending_.push_back(pool_.submit(std::forward<F>(task)));
+  }
+
+  /** Consume all results still in flight */
+  void finish() {
+    while (!pending_.empty()) {
+      consumeNext();
+    }
+  }
+
+private:
+  void consumeNext() {
+    Result result = pending_.front().get();
+    pending_.pop_front();
+    consume_(std::move(result));
+  }
+
+  ThreadPool& pool_;
+  size_t window_;
+  std::function<void(Result&&)> consume_;
+  std::deque<std::future<Result>> pending_;
+};
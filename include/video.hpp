@@ -1,10 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
 
+struct AVFormatContext;
+struct AVIOContext;
+
 struct VideoDecoderConfig {
   /** The mime type of the bitstream: ["video/avc", "video/hevc", "video/AV1"] */
   std::string mime;
@@ -27,7 +33,89 @@ struct VideoFrame {
   bool isKeyframe;
 };
 
-std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const std::string& videoFilename);
+/**
+ * An opened and probed video container. The input is probed exactly once when it is opened, so
+ * the same VideoSource can be passed to GetVideoDecoderConfig() and then ExtractVideoFrames() even
+ * when it is a pipe that cannot be rewound.
+ */
+class VideoSource {
+public:
+  /**
+   * Open and probe `videoFilename`. A filename of "-" reads from stdin. Pipes, FIFOs and other
+   * non-seekable inputs are read through a custom AVIO context instead of by name. If `interrupt`
+   * is set, reads blocked on a pipe are abandoned once it becomes true.
+   */
+  static std::unique_ptr<VideoSource> Open(const std::string& videoFilename,
+                                           const std::atomic<bool>* interrupt = nullptr);
+
+  ~VideoSource();
+  VideoSource(const VideoSource&) = delete;
+  VideoSource& operator=(const VideoSource&) = delete;
+
+  const std::string& filename() const {
+    return filename_;
+  }
+  /** True if the input is read through a custom AVIO context (stdin, FIFO, socket) */
+  bool isStream() const {
+    return ioCtx_ != nullptr;
+  }
+  bool interrupted() const {
+    return interrupt_ && interrupt_->load();
+  }
+  AVFormatContext* formatContext() const {
+    return formatCtx_;
+  }
+  /** Short name of the detected container format, e.g. "mov,mp4,m4a,3gp,3g2,mj2" or "mjpeg" */
+  std::string formatName() const;
+
+private:
+  VideoSource() = default;
+
+  static int ReadPacket(void* opaque, uint8_t* buf, int bufSize);
+  static int CheckInterrupt(void* opaque);
+
+  std::string filename_;
+  AVFormatContext* formatCtx_ = nullptr;
+  AVIOContext* ioCtx_ = nullptr;
+  int fd_ = -1;
+  bool ownsFd_ = false;
+  const std::atomic<bool>* interrupt_ = nullptr;
+};
+
+std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const VideoSource& source);
+
+/**
+ * If the video stream of `source` is a sequence of still images (MJPEG), returns the
+ * `foxglove.CompressedImage` format string of each frame, e.g. "jpeg".
+ */
+std::optional<std::string> GetImageFormat(const VideoSource& source);
+
+/**
+ * A GOP-aligned part of the video stream: the frames from one keyframe up to, but excluding, a
+ * later keyframe. Timestamps are decode timestamps in the time base of the stream.
+ */
+struct VideoRange {
+  int64_t startTimestamp = 0;
+  /** Timestamp of the first frame after the range, INT64_MAX for the last range */
+  int64_t endTimestamp = INT64_MAX;
+  /** Number of frames in the stream before the range */
+  uint32_t firstFrame = 0;
+  uint32_t frameCount = 0;
+};
+
+/**
+ * Split the video stream of `source` into GOP-aligned ranges of roughly `targetBytes` of packet
+ * data each, using the keyframe positions in the container index (e.g. MP4 `stss` and sample
+ * tables). Returns an empty vector unless `source` is a seekable file whose index lists every
+ * frame of the stream and splits into at least two ranges.
+ */
+std::vector<VideoRange> GetVideoRanges(const VideoSource& source, uint64_t targetBytes);
 
-bool ExtractVideoFrames(const std::string& videoFilename,
-                        std::function<void(const VideoFrame&)> callback);
+/**
+ * Demux every frame of the first video stream in `source`, convert it to Annex B format (H.264,
+ * HEVC) or pass it through unchanged (MJPEG), and fire `callback` for each frame. If `range` is
+ * given, seek to its first keyframe and stop at its end instead. Returns true when the end of the
+ * input (or range) is reached or the source is interrupted, false on error.
+ */
+bool ExtractVideoFrames(VideoSource& source, std::function<void(const VideoFrame&)> callback,
+                        const VideoRange* range = nullptr);
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <google/protobuf/descriptor.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Minimal protobuf wire format primitives for scanning serialized messages without deserializing
+// them into message objects. Each reader advances `pos` and returns false on truncated input.
+
+enum class WireType : uint8_t {
+  Varint = 0,
+  Fixed64 = 1,
+  LengthDelimited = 2,
+  StartGroup = 3,
+  EndGroup = 4,
+  Fixed32 = 5,
+};
+
+inline bool ReadVarint(const std::byte*& pos, const std::byte* end, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+    const auto byte = uint8_t(*pos++);
+    value |= uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool ReadFixed32(const std::byte*& pos, const std::byte* end, uint32_t& value) {
+  if (end - pos < 4) {
+    return false;
+  }
+  std::memcpy(&value, pos, 4);  // protobuf is little-endian, as are all supported targets
+  pos += 4;
+  return true;
+}
+
+inline bool ReadFixed64(const std::byte*& pos, const std::byte* end, uint64_t& value) {
+  if (end - pos < 8) {
+    return false;
+  }
+  std::memcpy(&value, pos, 8);
+  pos += 8;
+  return true;
+}
+
+/** Read the length prefix of a length-delimited field and return its payload */
+inline bool ReadLengthDelimited(const std::byte*& pos, const std::byte* end,
+                                std::string_view& value) {
+  uint64_t length = 0;
+  if (!ReadVarint(pos, end, length) || length > uint64_t(end - pos)) {
+    return false;
+  }
+  value = std::string_view{reinterpret_cast<const char*>(pos), size_t(length)};
+  pos += length;
+  return true;
+}
+
+/** Read a field tag, splitting it into its field number and wire type */
+inline bool ReadTag(const std::byte*& pos, const std::byte* end, uint32_t& fieldNumber,
+                    WireType& wireType) {
+  uint64_t tag = 0;
+  if (!ReadVarint(pos, end, tag) || (tag >> 3) == 0 || (tag >> 3) > UINT32_MAX) {
+    return false;
+  }
+  fieldNumber = uint32_t(tag >> 3);
+  wireType = WireType(tag & 7);
+  return true;
+}
+
+/** Skip the value of a field with the given wire type, without looking at its contents */
+inline bool SkipField(const std::byte*& pos, const std::byte* end, WireType wireType) {
+  switch (wireType) {
+    case WireType::Varint: {
+      uint64_t value = 0;
+      return ReadVarint(pos, end, value);
+    }
+    case WireType::Fixed64:
+      if (end - pos < 8) {
+        return false;
+      }
+      pos += 8;
+      return true;
+    case WireType::LengthDelimited: {
+      std::string_view value;
+      return ReadLengthDelimited(pos, end, value);
+    }
+    case WireType::Fixed32:
+      if (end - pos < 4) {
+        return false;
+      }
+      pos += 4;
+      return true;
+    case WireType::StartGroup: {
+      // Groups are deprecated, but skip them correctly by consuming fields until the matching end
+      uint32_t fieldNumber = 0;
+      WireType nestedType{};
+      while (ReadTag(pos, end, fieldNumber, nestedType)) {
+        if (nestedType == WireType::EndGroup) {
+          return true;
+        } else if (!SkipField(pos, end, nestedType)) {
+          return false;
+        }
+      }
+      return false;
+    }
+    case WireType::EndGroup:
+    default:
+      return false;
+  }
+}
+
+inline int64_t ZigZagDecode(uint64_t value) {
+  return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+/** The wire type a field is serialized with when not packed */
+WireType WireTypeOf(const google::protobuf::FieldDescriptor* field);
+
+/**
+ * The default value of a scalar field in the 64-bit representation scanners read values into:
+ * signed integers and enums sign-extended, floats and doubles as their bit patterns. 0 for string
+ * and bytes fields, whose default is `field->default_value_string()`.
+ */
+uint64_t ScalarDefault(const google::protobuf::FieldDescriptor* field);
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <mcap/mcap.hpp>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ChunkedWriterOptions {
+  std::string profile;
+  mcap::Compression compression = mcap::Compression::Zstd;
+  /** Codec-specific compression level, 0 for the default of the codec */
+  int compressionLevel = 0;
+  uint64_t chunkSize = mcap::DefaultChunkSize;
+};
+
+/**
+ * Everything needed to continue writing a data section and to rebuild the summary section for it.
+ */
+struct ChunkedWriterState {
+  /** File offset just past the last complete data section record */
+  uint64_t dataEnd = 0;
+  std::map<mcap::SchemaId, mcap::Schema> schemas;
+  std::map<mcap::ChannelId, mcap::Channel> channels;
+  std::vector<mcap::ChunkIndex> chunkIndexes;
+  std::vector<mcap::AttachmentIndex> attachmentIndexes;
+  std::vector<mcap::MetadataIndex> metadataIndexes;
+  mcap::Statistics statistics{};
+};
+
+/**
+ * A MCAP writer working at the level of chunks. Unlike mcap::McapWriter it preserves schema and
+ * channel IDs, can copy already serialized (and compressed) chunks verbatim, and can resume
+ * appending to a file it wrote earlier given the state it had at that point.
+ */
+class ChunkedWriter {
+public:
+  ChunkedWriter();
+  ~ChunkedWriter();
+  ChunkedWriter(const ChunkedWriter&) = delete;
+  ChunkedWriter& operator=(const ChunkedWriter&) = delete;
+
+  /** Create (or truncate) `filename` and write the MCAP header */
+  mcap::Status open(const std::string& filename, const ChunkedWriterOptions& options);
+
+  /**
+   * Reopen a file previously written by ChunkedWriter, discard everything past `state.dataEnd` (the
+   * old summary section or a partially written chunk), and continue writing after it.
+   */
+  mcap::Status resume(const std::string& filename, const ChunkedWriterOptions& options,
+                      const ChunkedWriterState& state);
+
+  /** Write a schema record, keeping its ID. Schemas already written are ignored. */
+  void addSchema(const mcap::Schema& schema);
+  /** Write a channel record, keeping its ID. Channels already written are ignored. */
+  void addChannel(const mcap::Channel& channel);
+
+  /** Append a message to the current chunk, closing the chunk once it reaches the chunk size */
+  mcap::Status write(const mcap::Message& message);
+  mcap::Status write(const mcap::Metadata& metadata);
+  mcap::Status write(const mcap::Attachment& attachment);
+
+  /**
+   * Write a chunk whose records are already serialized and compressed, followed by its message
+   * indexes. Message index offsets are relative to the uncompressed chunk records, so indexes read
+   * from another file carry over unchanged. The current chunk is closed first.
+   */
+  mcap::Status writeChunk(const mcap::Chunk& chunk,
+                          const std::vector<mcap::MessageIndex>& messageIndexes);
+
+  /** Compress and write the current chunk, if it holds any messages */
+  mcap::Status closeChunk();
+  /** Close the current chunk and hand all buffered output to the operating system */
+  mcap::Status flush();
+  /** Close the current chunk, write the summary section and footer, and close the file */
+  mcap::Status close();
+
+  /** The state as of the last complete record. Call flush() first to include the current chunk. */
+  const ChunkedWriterState& state() const {
+    return state_;
+  }
+  const std::string& filename() const {
+    return filename_;
+  }
+
+private:
+  class FileSink;
+  class BufferSink;
+
+  mcap::Status writeChunkRecords(const mcap::Chunk& chunk,
+                                 const std::vector<mcap::MessageIndex>& messageIndexes);
+  // Must be called before messageCount is increased for the new messages
+  void recordMessageTimes(mcap::Timestamp startTime, mcap::Timestamp endTime);
+
+  std::string filename_;
+  ChunkedWriterOptions options_{};
+  ChunkedWriterState state_;
+  std::unique_ptr<FileSink> file_;
+
+  // The chunk currently being built
+  std::unique_ptr<BufferSink> chunkBuffer_;
+  std::map<mcap::ChannelId, mcap::MessageIndex> chunkMessageIndexes_;
+  mcap::Timestamp chunkStartTime_ = 0;
+  mcap::Timestamp chunkEndTime_ = 0;
+  std::vector<std::byte> compressedBuffer_;
+};
+
+/**
+ * Copy the metadata and attachment records listed in the summary of `reader` to `writer`. Fails on
+ * the first record that cannot be read, parsed or written.
+ */
+mcap::Status CopyMetadataAndAttachments(mcap::McapReader& reader, ChunkedWriter& writer);
@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+
+set -eu
+set -o pipefail
+
+: '
+
+Streams a generated fragmented MP4 through a FIFO into `mcaptool convert`
+
+Usage: ./scripts/convert-fifo.sh [output.mcap] [seconds]
+
+Requires the `ffmpeg` CLI with libx264. Press Ctrl-C to stop early; the output
+file is still finalized with a summary section.
+
+'
+
+output=${1:-fifo.mcap}
+seconds=${2:-10}
+mcaptool=${MCAPTOOL:-./build/mcaptool}
+
+tmpdir=$(mktemp -d)
+fifo="$tmpdir/input.mp4"
+mkfifo "$fifo"
+trap 'rm -rf "$tmpdir"' EXIT
+
+# Generate a live-paced H.264 test pattern as fragmented MP4 (one fragment per keyframe)
+ffmpeg -hide_banner -loglevel error -re \
+  -f lavfi -i "testsrc2=size=640x480:rate=30:duration=$seconds" \
+  -c:v libx264 -bf 0 -g 30 -pix_fmt yuv420p \
+  -movflags frag_keyframe+empty_moov+default_base_moof \
+  -f mp4 -y "$fifo" &
+
+"$mcaptool" convert --max-chunk-duration 1000 "$fifo" "$output"
+wait
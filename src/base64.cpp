@@ -0,0 +1,27 @@
+#include "base64.hpp"
+
+#include <libbase64.h>
+
+std::string BytesToBase64(const mcap::ByteArray& bytes) {
+  std::string res;
+  // 4/3 the size of the input, rounded up to the nearest multiple of 4
+  const size_t fourThirds = bytes.size() * 4 / 3;
+  size_t outLength = fourThirds + (4 - fourThirds % 4);
+  res.resize(outLength);
+  base64_encode(reinterpret_cast<const char*>(bytes.data()), bytes.size(), &res[0], &outLength, 0);
+  res.resize(outLength);
+  return res;
+}
+
+std::optional<mcap::ByteArray> Base64ToBytes(const std::string& base64) {
+  mcap::ByteArray bytes;
+  // Decoding never produces more than 3/4 the size of the input
+  size_t outLength = base64.size() * 3 / 4 + 3;
+  bytes.resize(outLength);
+  if (base64_decode(base64.data(), base64.size(), reinterpret_cast<char*>(bytes.data()),
+                    &outLength, 0) != 1) {
+    return {};
+  }
+  bytes.resize(outLength);
+  return bytes;
+}
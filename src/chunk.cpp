@@ -0,0 +1,202 @@
+#include "chunk.hpp"
+
+#include <lz4frame.h>
+#include <zstd.h>
+
+#include <memory>
+
+// Decompression and compression contexts are reused per thread, since chunks are usually
+// processed on worker threads
+struct ZstdContexts {
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  ZSTD_CCtx* cctx = ZSTD_createCCtx();
+
+  ~ZstdContexts() {
+    ZSTD_freeDCtx(dctx);
+    ZSTD_freeCCtx(cctx);
+  }
+};
+
+static ZstdContexts& ThreadZstdContexts() {
+  thread_local ZstdContexts contexts;
+  return contexts;
+}
+
+static uint64_t ReadUint64LE(const std::byte* data) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--) {
+    value = (value << 8) | uint64_t(data[i]);
+  }
+  return value;
+}
+
+std::string CompressionName(mcap::Compression compression) {
+  switch (compression) {
+    case mcap::Compression::Lz4:
+      return "lz4";
+    case mcap::Compression::Zstd:
+      return "zstd";
+    case mcap::Compression::None:
+    default:
+      return "";
+  }
+}
+
+mcap::Status DecompressChunk(const mcap::Chunk& chunk, std::vector<std::byte>& buffer,
+                             const std::byte** records) {
+  if (chunk.compression.empty()) {
+    if (chunk.compressedSize != chunk.uncompressedSize) {
+      return mcap::Status{mcap::StatusCode::DecompressionSizeMismatch,
+                          "uncompressed chunk size mismatch"};
+    }
+    *records = chunk.records;
+    return mcap::Status{mcap::StatusCode::Success};
+  }
+
+  buffer.resize(chunk.uncompressedSize);
+  if (chunk.compression == "zstd") {
+    const size_t result = ZSTD_decompressDCtx(ThreadZstdContexts().dctx, buffer.data(),
+                                              buffer.size(), chunk.records, chunk.compressedSize);
+    if (ZSTD_isError(result)) {
+      return mcap::Status{mcap::StatusCode::DecompressionFailed, ZSTD_getErrorName(result)};
+    } else if (result != chunk.uncompressedSize) {
+      return mcap::Status{mcap::StatusCode::DecompressionSizeMismatch,
+                          "zstd chunk decompressed to an unexpected size"};
+    }
+  } else if (chunk.compression == "lz4") {
+    LZ4F_dctx* dctx = nullptr;
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+      return mcap::Status{mcap::StatusCode::DecompressionFailed, "LZ4F_createDecompressionContext"};
+    }
+    size_t srcOffset = 0;
+    size_t dstOffset = 0;
+    size_t result = 1;
+    while (result != 0 && srcOffset < chunk.compressedSize) {
+      size_t srcSize = chunk.compressedSize - srcOffset;
+      size_t dstSize = buffer.size() - dstOffset;
+      result = LZ4F_decompress(dctx, buffer.data() + dstOffset, &dstSize,
+                               chunk.records + srcOffset, &srcSize, nullptr);
+      if (LZ4F_isError(result)) {
+        LZ4F_freeDecompressionContext(dctx);
+        return mcap::Status{mcap::StatusCode::DecompressionFailed, LZ4F_getErrorName(result)};
+      } else if (srcSize == 0 && dstSize == 0) {
+        break;
+      }
+      srcOffset += srcSize;
+      dstOffset += dstSize;
+    }
+    LZ4F_freeDecompressionContext(dctx);
+    if (dstOffset != chunk.uncompressedSize) {
+      return mcap::Status{mcap::StatusCode::DecompressionSizeMismatch,
+                          "lz4 chunk decompressed to an unexpected size"};
+    }
+  } else {
+    return mcap::Status{mcap::StatusCode::UnrecognizedCompression,
+                        "unsupported chunk compression \"" + chunk.compression + "\""};
+  }
+
+  *records = buffer.data();
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status CompressChunk(const std::string& compression, int level, const std::byte* data,
+                           uint64_t size, std::vector<std::byte>& output) {
+  if (compression == "zstd") {
+    output.resize(ZSTD_compressBound(size));
+    const size_t result = ZSTD_compressCCtx(ThreadZstdContexts().cctx, output.data(),
+                                            output.size(), data, size, level == 0 ? 1 : level);
+    if (ZSTD_isError(result)) {
+      return mcap::Status{mcap::StatusCode::UnrecognizedCompression, ZSTD_getErrorName(result)};
+    }
+    output.resize(result);
+  } else if (compression == "lz4") {
+    LZ4F_preferences_t prefs{};
+    prefs.compressionLevel = level;
+    prefs.frameInfo.contentSize = size;
+    output.resize(LZ4F_compressFrameBound(size, &prefs));
+    const size_t result = LZ4F_compressFrame(output.data(), output.size(), data, size, &prefs);
+    if (LZ4F_isError(result)) {
+      return mcap::Status{mcap::StatusCode::UnrecognizedCompression, LZ4F_getErrorName(result)};
+    }
+    output.resize(result);
+  } else {
+    return mcap::Status{mcap::StatusCode::UnrecognizedCompression,
+                        "unsupported chunk compression \"" + compression + "\""};
+  }
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status RecordAt(const std::byte* data, uint64_t size, uint64_t offset,
+                      mcap::Record* record) {
+  // Each record is a one byte opcode, a uint64 little-endian length, and the record data
+  constexpr uint64_t RecordPrefixSize = 9;
+  if (offset > size || size - offset < RecordPrefixSize) {
+    return mcap::Status{mcap::StatusCode::InvalidRecord, "truncated record prefix"};
+  }
+  record->opcode = mcap::OpCode(data[offset]);
+  record->dataSize = ReadUint64LE(data + offset + 1);
+  if (record->dataSize > size - offset - RecordPrefixSize) {
+    return mcap::Status{mcap::StatusCode::InvalidRecord, "record extends past end of buffer"};
+  }
+  // mcap::Record holds a mutable pointer, but parsers only read through it
+  record->data = const_cast<std::byte*>(data + offset + RecordPrefixSize);
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status ForEachRecord(const std::byte* data, uint64_t size,
+                           const std::function<bool(const mcap::Record&, uint64_t)>& callback) {
+  uint64_t offset = 0;
+  while (offset < size) {
+    mcap::Record record;
+    const auto status = RecordAt(data, size, offset, &record);
+    if (!status.ok()) {
+      return status;
+    }
+    if (!callback(record, offset)) {
+      break;
+    }
+    offset += record.recordSize();
+  }
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status ReadChunk(mcap::IReadable& reader, const mcap::ChunkIndex& chunkIndex,
+                       mcap::Chunk* chunk) {
+  mcap::Record record;
+  const auto status = mcap::McapReader::ReadRecord(reader, chunkIndex.chunkStartOffset, &record);
+  if (!status.ok()) {
+    return status;
+  } else if (record.opcode != mcap::OpCode::Chunk) {
+    return mcap::Status{mcap::StatusCode::InvalidChunkOffset,
+                        "chunk index does not point to a chunk"};
+  }
+  return mcap::McapReader::ParseChunk(record, chunk);
+}
+
+mcap::Status ReadMessageIndexes(mcap::IReadable& reader, const mcap::ChunkIndex& chunkIndex,
+                                std::vector<mcap::MessageIndex>& messageIndexes) {
+  messageIndexes.clear();
+  if (chunkIndex.messageIndexLength == 0) {
+    return mcap::Status{mcap::StatusCode::Success};
+  }
+
+  // The message indexes of a chunk are stored contiguously after it, so read them all at once
+  std::byte* data = nullptr;
+  const uint64_t offset = chunkIndex.chunkStartOffset + chunkIndex.chunkLength;
+  if (reader.read(&data, offset, chunkIndex.messageIndexLength) != chunkIndex.messageIndexLength) {
+    return mcap::Status{mcap::StatusCode::ReadFailed, "failed to read message indexes"};
+  }
+  mcap::Status parseStatus{mcap::StatusCode::Success};
+  const auto status = ForEachRecord(data, chunkIndex.messageIndexLength,
+                                    [&](const mcap::Record& record, uint64_t) {
+                                      if (record.opcode != mcap::OpCode::MessageIndex) {
+                                        return true;
+                                      }
+                                      mcap::MessageIndex messageIndex;
+                                      parseStatus =
+                                        mcap::McapReader::ParseMessageIndex(record, &messageIndex);
+                                      messageIndexes.push_back(std::move(messageIndex));
+                                      return parseStatus.ok();
+                                    });
+  return status.ok() ? parseStatus : status;
+}
@@ -3,24 +3,87 @@
 #include <mcap/mcap.hpp>
 #include <spdlog/spdlog.h>
 
-#include <libbase64.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <vector>
 
+#include "base64.hpp"
 #include "foxglove/CameraCalibration.pb.h"
 #include "foxglove/CompressedVideo.pb.h"
+#include "images.hpp"
 #include "protobuf.hpp"
+#include "threadpool.hpp"
 #include "video.hpp"
 
-static std::string BytesToBase64(const mcap::ByteArray& bytes) {
-  std::string res;
-  // 4/3 the size of the input, rounded up to the nearest multiple of 4
-  const size_t fourThirds = bytes.size() * 4 / 3;
-  size_t outLength = fourThirds + (4 - fourThirds % 4);
-  res.resize(outLength);
-  base64_encode(reinterpret_cast<const char*>(bytes.data()), bytes.size(), &res[0], &outLength, 0);
-  res.resize(outLength);
-  return res;
-}
+/**
+ * An mcap::IWritable backed by a stdio file that can be flushed on demand, so completed chunks
+ * reach disk while the writer is still open. IWritable cannot report errors, so the first failed
+ * write, flush or close (e.g. a full disk) is recorded, later writes are dropped, and the owner
+ * checks failed() once the file is closed.
+ */
+class FlushableFileWriter final : public mcap::IWritable {
+public:
+  ~FlushableFileWriter() override {
+    end();
+  }
+
+  mcap::Status open(const std::string& filename) {
+    file_ = std::fopen(filename.c_str(), "wb");
+    if (!file_) {
+      return mcap::Status{mcap::StatusCode::OpenFailed, "failed to open \"" + filename + "\""};
+    }
+    return mcap::Status{mcap::StatusCode::Success};
+  }
+
+  void handleWrite(const std::byte* data, uint64_t size) override {
+    if (!failed_ && std::fwrite(data, 1, size, file_) != size) {
+      fail("write");
+    }
+    size_ += size;
+  }
+
+  void end() override {
+    if (file_) {
+      if (std::fclose(file_) != 0) {
+        fail("close");
+      }
+      file_ = nullptr;
+    }
+  }
+
+  uint64_t size() const override {
+    return size_;
+  }
+
+  void flush() {
+    if (file_ && !failed_ && std::fflush(file_) != 0) {
+      fail("flush");
+    }
+  }
+
+  bool failed() const {
+    return failed_;
+  }
+
+private:
+  void fail(const char* operation) {
+    if (!failed_) {
+      spdlog::error("Failed to {} output file: {}", operation, std::strerror(errno));
+      failed_ = true;
+    }
+  }
+
+  std::FILE* file_ = nullptr;
+  uint64_t size_ = 0;
+  bool failed_ = false;
+};
 
 static foxglove::CameraCalibration CreateDummyCalibration(uint32_t width, uint32_t height) {
   constexpr double EXAMPLE_FOCAL_LENGTH_MM = 1.88;  // From the Intel RealSense D435 datasheet
@@ -71,28 +134,45 @@ static foxglove::CameraCalibration CreateDummyCalibration(uint32_t width, uint32
   return calibration;
 }
 
-bool Convert(const std::string& inputFilename, const std::string& outputFilename) {
-  const auto config = GetVideoDecoderConfig(inputFilename);
-  if (!config) {
-    return false;
-  }
-
-  spdlog::debug("Input is {}x{} {}; codecs=\"{}\"", config->codedWidth, config->codedHeight,
-                config->mime, config->codec);
+/**
+ * One MCAP file written from the frames of a single demux pass. A full output keeps every frame,
+ * while a preview output keeps only keyframes, optionally decimated to a maximum frame rate.
+ */
+struct VideoOutput {
+  std::string filename;
+  bool keyframesOnly = false;
+  /** Minimum log time difference between two kept frames, in nanoseconds */
+  uint64_t minFrameInterval = 0;
+  uint64_t maxChunkDuration = 0;
 
-  // Open the output file
+  FlushableFileWriter file;
   mcap::McapWriter writer;
-  mcap::McapWriterOptions writerOpts{""};
-  writerOpts.compression = mcap::Compression::None;
-  writerOpts.noChunkCRC = true;
-  auto status = writer.open(outputFilename, writerOpts);
+  mcap::Channel videoChannel;
+  mcap::Channel keyframeChannel;
+  std::vector<std::pair<uint32_t, uint64_t>> keyframes;
+  std::optional<uint64_t> chunkStartTime;
+  std::optional<uint64_t> lastFrameTime;
+  size_t frameCount = 0;
+
+  VideoOutput(const std::string& name)
+      : filename(name) {}
+};
+
+// Open `output` and write the schemas, channels and the dummy calibration message
+static bool OpenVideoOutput(VideoOutput& output, const VideoDecoderConfig& config,
+                            const std::string& keyframeTopicName) {
+  auto status = output.file.open(output.filename);
   if (!status.ok()) {
     spdlog::error("Failed to open output file: {}", status.message);
     return false;
   }
+  mcap::McapWriter& writer = output.writer;
+  mcap::McapWriterOptions writerOpts{""};
+  writerOpts.compression = mcap::Compression::None;
+  writerOpts.noChunkCRC = true;
+  writer.open(output.file, writerOpts);
 
   const std::string topicName = "video";
-  const std::string keyframeTopicName = "video/keyframes";
   const std::string calibrationTopicName = "video/calibration";
 
   // Create a schema for `foxglove.CameraCalibration`. A dummy calibration is
@@ -112,7 +192,7 @@ bool Convert(const std::string& inputFilename, const std::string& outputFilename
   mcap::Channel calibrationChannel{calibrationTopicName, "protobuf", calibrationSchema.id, {}};
   writer.addChannel(calibrationChannel);
   const auto calibration =
-    CreateDummyCalibration(uint32_t(config->codedWidth), uint32_t(config->codedHeight));
+    CreateDummyCalibration(uint32_t(config.codedWidth), uint32_t(config.codedHeight));
   const auto serializedCalibration = calibration.SerializeAsString();
   mcap::Message calibrationMsg{};
   calibrationMsg.channelId = calibrationChannel.id;
@@ -125,97 +205,393 @@ bool Convert(const std::string& inputFilename, const std::string& outputFilename
   }
 
   // Create a channel for the "video" topic
-  mcap::KeyValueMap keyframeMetadata{
-    {"codec", config->codec},
-    {"codedWidth", std::to_string(config->codedWidth)},
-    {"codedHeight", std::to_string(config->codedHeight)},
-    {"keyframeIndex", keyframeTopicName},
-  };
-  if (!config->description.empty()) {
-    keyframeMetadata["configuration"] = BytesToBase64(config->description);
-  }
-  mcap::Channel videoChannel{topicName, "protobuf", schema.id};
-  writer.addChannel(videoChannel);
+  output.videoChannel = mcap::Channel{topicName, "protobuf", schema.id};
+  writer.addChannel(output.videoChannel);
 
   // Create a topic fo the "video/keyframes" topic
-  mcap::Channel keyframeChannel{keyframeTopicName, "", 0};
-  writer.addChannel(keyframeChannel);
+  output.keyframeChannel = mcap::Channel{keyframeTopicName, "", 0};
+  writer.addChannel(output.keyframeChannel);
 
-  const std::string mime = config->mime;
-  uint32_t frameNumber = 0;
-  std::vector<std::pair<uint32_t, uint64_t>> keyframes;
-  std::vector<uint8_t> serializedMsg;
-
-  // Write video data to the "video" topic
-  const bool result = ExtractVideoFrames(inputFilename, [&](const VideoFrame& frame) {
-    foxglove::CompressedVideo video;
-    video.mutable_timestamp()->set_seconds(int64_t(frame.timestamp / 1000000000));
-    video.mutable_timestamp()->set_nanos(int32_t(frame.timestamp % 1000000000));
-    video.set_frame_id("video");
-    video.set_data(frame.data, frame.size);
-    video.set_keyframe(frame.isKeyframe);
-    if (frame.isKeyframe) {
-      // video.metadata is an array of `KeyValuePair` structs. Fill it out from
-      // the keyframe metadata map
-      for (const auto& [key, value] : keyframeMetadata) {
-        auto* pair = video.add_metadata();
-        pair->set_key(key);
-        pair->set_value(value);
-      }
+  return true;
+}
 
-      keyframes.emplace_back(frameNumber, frame.timestamp);
+// Serialize `frame` as a `foxglove.CompressedVideo` message into `serializedMsg` at `offset`,
+// growing it as needed, and return the serialized size
+static size_t SerializeVideoFrame(const VideoFrame& frame,
+                                  const mcap::KeyValueMap& keyframeMetadata,
+                                  std::vector<uint8_t>& serializedMsg, size_t offset = 0) {
+  foxglove::CompressedVideo video;
+  video.mutable_timestamp()->set_seconds(int64_t(frame.timestamp / 1000000000));
+  video.mutable_timestamp()->set_nanos(int32_t(frame.timestamp % 1000000000));
+  video.set_frame_id("video");
+  video.set_data(frame.data, frame.size);
+  video.set_keyframe(frame.isKeyframe);
+  if (frame.isKeyframe) {
+    // video.metadata is an array of `KeyValuePair` structs. Fill it out from
+    // the keyframe metadata map
+    for (const auto& [key, value] : keyframeMetadata) {
+      auto* pair = video.add_metadata();
+      pair->set_key(key);
+      pair->set_value(value);
     }
+  }
 
-    // Serialize the protobuf message to a vector of bytes
-    const size_t serializedSize = video.ByteSizeLong();
-    if (serializedSize > serializedMsg.size()) {
-      serializedMsg.resize(serializedSize);
-    }
-    video.SerializeWithCachedSizesToArray(serializedMsg.data());
+  // Serialize the protobuf message to a vector of bytes
+  const size_t serializedSize = video.ByteSizeLong();
+  if (offset + serializedSize > serializedMsg.size()) {
+    serializedMsg.resize(offset + serializedSize);
+  }
+  video.SerializeWithCachedSizesToArray(serializedMsg.data() + offset);
+  return serializedSize;
+}
 
-    // Create an MCAP message wrapping the serialized protobuf message and write
-    // it to the MCAP file (using the "video" topic via `videoChannel.id`)
-    mcap::Message msg;
-    msg.channelId = videoChannel.id;
-    msg.sequence = frameNumber;
-    msg.logTime = frame.timestamp;
-    msg.publishTime = frame.timestamp;
-    msg.dataSize = serializedSize;
-    msg.data = reinterpret_cast<const std::byte*>(serializedMsg.data());
-    const auto writeStatus = writer.write(msg);
-    if (!writeStatus.ok()) {
-      spdlog::error("Failed to write video frame {} ({} bytes): {}", frameNumber, frame.size,
-                    writeStatus.message);
+// Returns true if `output` keeps a frame. Frames are selected without decoding: a preview keeps
+// keyframes only, since dropping any other frame would leave its dependents undecodable
+static bool SelectVideoFrame(VideoOutput& output, uint64_t timestamp, bool isKeyframe) {
+  if (output.keyframesOnly && !isKeyframe) {
+    return false;
+  }
+  if (output.minFrameInterval > 0 && output.lastFrameTime &&
+      timestamp < *output.lastFrameTime + output.minFrameInterval) {
+    return false;
+  }
+  output.lastFrameTime = timestamp;
+  return true;
+}
+
+// Write a serialized `foxglove.CompressedVideo` message to the "video" topic of `output`
+static void WriteVideoFrame(VideoOutput& output, uint32_t frameNumber, uint64_t timestamp,
+                            bool isKeyframe, const std::byte* data, size_t size) {
+  // Close the current chunk and flush it to disk once it spans `maxChunkDuration` of video
+  if (output.maxChunkDuration > 0) {
+    if (output.chunkStartTime && timestamp >= *output.chunkStartTime + output.maxChunkDuration) {
+      output.writer.closeLastChunk();
+      output.file.flush();
+      output.chunkStartTime.reset();
+    }
+    if (!output.chunkStartTime) {
+      output.chunkStartTime = timestamp;
     }
+  }
 
-    frameNumber++;
-  });
+  if (isKeyframe) {
+    output.keyframes.emplace_back(frameNumber, timestamp);
+  }
 
-  if (!result) {
-    spdlog::error("Failed to extract video frames from \"{}\"", inputFilename);
+  // Create an MCAP message wrapping the serialized protobuf message and write
+  // it to the MCAP file (using the "video" topic via `videoChannel.id`)
+  mcap::Message msg;
+  msg.channelId = output.videoChannel.id;
+  msg.sequence = frameNumber;
+  msg.logTime = timestamp;
+  msg.publishTime = timestamp;
+  msg.dataSize = size;
+  msg.data = data;
+  const auto writeStatus = output.writer.write(msg);
+  if (!writeStatus.ok()) {
+    spdlog::error("Failed to write video frame {} ({} bytes) to \"{}\": {}", frameNumber, size,
+                  output.filename, writeStatus.message);
   }
 
+  output.frameCount++;
+}
+
+// Write the "video/keyframes" index and the summary section of `output`
+// Returns false if the output could not be written completely
+static bool CloseVideoOutput(VideoOutput& output) {
   // Close the current chunk to ensure keyframes are written to a separate chunk
-  writer.closeLastChunk();
+  output.writer.closeLastChunk();
 
   // Write empty keyframe messages to the "video/keyframes" topic
-  for (const auto& [sequence, timestamp] : keyframes) {
+  for (const auto& [sequence, timestamp] : output.keyframes) {
     mcap::Message msg;
-    msg.channelId = keyframeChannel.id;
+    msg.channelId = output.keyframeChannel.id;
     msg.sequence = sequence;
     msg.logTime = timestamp;
     msg.publishTime = timestamp;
     msg.dataSize = 0;
     msg.data = nullptr;
-    const auto writeStatus = writer.write(msg);
+    const auto writeStatus = output.writer.write(msg);
     if (!writeStatus.ok()) {
       spdlog::error("Failed to write keyframe message {}: {}", sequence, writeStatus.message);
     }
   }
 
-  writer.close();
-  spdlog::debug("Wrote {} video frames ({} keyframes) to \"{}\"", frameNumber, keyframes.size(),
-                outputFilename);
-
+  // Write the summary section. This also runs after an interrupt so the output is a complete file
+  output.writer.close();
+  if (output.file.failed()) {
+    spdlog::error("\"{}\" is incomplete", output.filename);
+    return false;
+  }
+  spdlog::info("Wrote {} video frames ({} keyframes, {} bytes) to \"{}\"", output.frameCount,
+               output.keyframes.size(), output.file.size(), output.filename);
   return true;
 }
+
+// Packet data per range when converting in parallel. Bounds the memory held by serialized ranges
+// waiting to be written to roughly this times the window size
+constexpr uint64_t ParallelRangeBytes = 16 * 1024 * 1024;
+
+// The frames of one VideoRange, serialized as `foxglove.CompressedVideo` messages by a worker
+struct SerializedRange {
+  struct Frame {
+    uint64_t timestamp;
+    bool isKeyframe;
+    // Location of the serialized message in `data`, empty for frames no output keeps
+    size_t offset;
+    size_t size;
+  };
+
+  bool ok = false;
+  std::vector<Frame> frames;
+  std::vector<uint8_t> data;
+};
+
+/**
+ * Opened VideoSources on one input file, each used by a single worker at a time. Opening a long
+ * MP4 file parses its complete sample tables, so sources are reused across ranges rather than
+ * opened per range.
+ */
+class VideoSourcePool {
+public:
+  VideoSourcePool(const std::string& filename, const std::atomic<bool>* interrupt)
+      : filename_(filename)
+      , interrupt_(interrupt) {}
+
+  std::unique_ptr<VideoSource> acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!sources_.empty()) {
+        auto source = std::move(sources_.back());
+        sources_.pop_back();
+        return source;
+      }
+    }
+    return VideoSource::Open(filename_, interrupt_);
+  }
+
+  void release(std::unique_ptr<VideoSource> source) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sources_.push_back(std::move(source));
+  }
+
+private:
+  std::string filename_;
+  const std::atomic<bool>* interrupt_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<VideoSource>> sources_;
+};
+
+// Demux and serialize the frames of `range`. With `keyframesOnly`, no output keeps delta frames,
+// so they are listed without being serialized
+static SerializedRange SerializeRange(VideoSourcePool& sources, const VideoRange& range,
+                                      const mcap::KeyValueMap& keyframeMetadata,
+                                      bool keyframesOnly) {
+  SerializedRange result;
+  auto source = sources.acquire();
+  if (!source) {
+    return result;
+  }
+  result.frames.reserve(range.frameCount);
+  result.ok = ExtractVideoFrames(
+    *source,
+    [&](const VideoFrame& frame) {
+      SerializedRange::Frame entry{frame.timestamp, frame.isKeyframe, result.data.size(), 0};
+      if (!keyframesOnly || frame.isKeyframe) {
+        entry.size = SerializeVideoFrame(frame, keyframeMetadata, result.data, entry.offset);
+      }
+      result.frames.push_back(entry);
+    },
+    &range);
+  sources.release(std::move(source));
+  return result;
+}
+
+// Convert the video ranges of `inputFilename` on a thread pool, writing their frames to `outputs`
+// in order. Produces the same output as a sequential ExtractVideoFrames() pass. Returns false if a
+// range could not be extracted or held a different number of frames than the index lists, in
+// which case the outputs end before that range
+static bool ConvertRanges(const std::string& inputFilename, const std::vector<VideoRange>& ranges,
+                          const mcap::KeyValueMap& keyframeMetadata,
+                          std::vector<std::unique_ptr<VideoOutput>>& outputs,
+                          const ConvertOptions& options) {
+  const bool keyframesOnly = std::all_of(outputs.begin(), outputs.end(), [](const auto& output) {
+    return output->keyframesOnly;
+  });
+  auto interrupted = [&]() {
+    return options.interrupt && options.interrupt->load();
+  };
+
+  // `pool` is declared after `sources` so its workers are joined before the sources are destroyed
+  VideoSourcePool sources{inputFilename, options.interrupt};
+  ThreadPool pool{options.threads};
+  size_t nextRange = 0;
+  bool ok = true;
+  bool stopped = false;
+
+  auto writeRange = [&](SerializedRange&& serialized) {
+    const VideoRange& range = ranges[nextRange++];
+    if (!ok || stopped) {
+      return;
+    } else if (!serialized.ok) {
+      spdlog::error("Failed to extract frames {}-{} from \"{}\"", range.firstFrame,
+                    range.firstFrame + range.frameCount, inputFilename);
+      ok = false;
+      return;
+    } else if (serialized.frames.size() != range.frameCount) {
+      // An interrupted worker returns a partial range. Ranges after it are dropped too, so the
+      // output ends at a frame boundary
+      if (!interrupted()) {
+        spdlog::error("Extracted {} frames from the range at frame {} of \"{}\", but the index "
+                      "lists {}",
+                      serialized.frames.size(), range.firstFrame, inputFilename, range.frameCount);
+        ok = false;
+      }
+      stopped = true;
+      return;
+    }
+
+    for (size_t i = 0; i < serialized.frames.size(); i++) {
+      const auto& frame = serialized.frames[i];
+      const uint32_t frameNumber = range.firstFrame + uint32_t(i);
+      for (auto& output : outputs) {
+        if (SelectVideoFrame(*output, frame.timestamp, frame.isKeyframe)) {
+          WriteVideoFrame(*output, frameNumber, frame.timestamp, frame.isKeyframe,
+                          reinterpret_cast<const std::byte*>(serialized.data.data() + frame.offset),
+                          frame.size);
+        }
+      }
+    }
+  };
+
+  // Ranges are large, so fewer of them are kept in flight than chunks elsewhere
+  OrderedResults<SerializedRange> results{pool, pool.size() * 2, writeRange};
+
+  for (const auto& range : ranges) {
+    if (!ok || stopped || interrupted()) {
+      break;
+    }
+    results.submit([&sources, &range, &keyframeMetadata, keyframesOnly]() {
+      return SerializeRange(sources, range, keyframeMetadata, keyframesOnly);
+    });
+  }
+  results.finish();
+
+  if (interrupted()) {
+    spdlog::info("Interrupted, stopping extraction from \"{}\"", inputFilename);
+  }
+  return ok;
+}
+
+bool Convert(const std::string& inputFilename, const std::string& outputFilename,
+             const ConvertOptions& options) {
+  // Spaces images without timestamps, also for jobs submitted to `serve`
+  if (!(options.fps > 0)) {
+    spdlog::error("Invalid frame rate {}, expected a positive rate", options.fps);
+    return false;
+  }
+
+  if (std::filesystem::is_directory(inputFilename)) {
+    return ConvertImageDirectory(inputFilename, outputFilename, options);
+  }
+
+  // Open and probe the input once. For pipes this is the only chance to read the stream header
+  auto source = VideoSource::Open(inputFilename, options.interrupt);
+  if (!source) {
+    return false;
+  }
+
+  if (const auto imageFormat = GetImageFormat(*source)) {
+    return ConvertMjpeg(*source, *imageFormat, outputFilename, options);
+  }
+
+  const auto config = GetVideoDecoderConfig(*source);
+  if (!config) {
+    return false;
+  }
+
+  spdlog::debug("Input is {}x{} {}; codecs=\"{}\"", config->codedWidth, config->codedHeight,
+                config->mime, config->codec);
+
+  // A maximum frame rate implies keyframe-only selection since frames are never decoded
+  const bool preview = options.keyframesOnly || options.maxFps > 0;
+  const uint64_t minFrameInterval = options.maxFps > 0 ? uint64_t(1e9 / options.maxFps) : 0;
+
+  // Open the output files. All of them are written from the same demux pass. Without a separate
+  // preview file, the preview selection applies to the main output
+  std::vector<std::unique_ptr<VideoOutput>> outputs;
+  outputs.push_back(std::make_unique<VideoOutput>(outputFilename));
+  if (!options.previewFilename.empty()) {
+    outputs.push_back(std::make_unique<VideoOutput>(options.previewFilename));
+  }
+  VideoOutput& previewOutput = *outputs.back();
+  if (preview || !options.previewFilename.empty()) {
+    previewOutput.keyframesOnly = true;
+    previewOutput.minFrameInterval = minFrameInterval;
+  }
+
+  const std::string keyframeTopicName = "video/keyframes";
+  for (auto& output : outputs) {
+    output->maxChunkDuration = options.maxChunkDuration;
+    if (!OpenVideoOutput(*output, *config, keyframeTopicName)) {
+      return false;
+    }
+  }
+
+  mcap::KeyValueMap keyframeMetadata{
+    {"codec", config->codec},
+    {"codedWidth", std::to_string(config->codedWidth)},
+    {"codedHeight", std::to_string(config->codedHeight)},
+    {"keyframeIndex", keyframeTopicName},
+  };
+  if (!config->description.empty()) {
+    keyframeMetadata["configuration"] = BytesToBase64(config->description);
+  }
+
+  std::vector<VideoRange> ranges;
+  if (options.parallel) {
+    ranges = GetVideoRanges(*source, ParallelRangeBytes);
+    if (ranges.empty()) {
+      spdlog::warn("\"{}\" is not a file with a complete frame index, converting sequentially",
+                   inputFilename);
+    } else {
+      spdlog::debug("Converting {} ranges of \"{}\" in parallel", ranges.size(), inputFilename);
+    }
+  }
+
+  // Write video data to the "video" topic of each output. A frame is serialized at most once no
+  // matter how many outputs keep it, and never when no output does
+  bool result = false;
+  if (!ranges.empty()) {
+    // ConvertRanges() logs which range failed
+    result = ConvertRanges(inputFilename, ranges, keyframeMetadata, outputs, options);
+  } else {
+    uint32_t frameNumber = 0;
+    std::vector<uint8_t> serializedMsg;
+    result = ExtractVideoFrames(*source, [&](const VideoFrame& frame) {
+      std::optional<size_t> serializedSize;
+      for (auto& output : outputs) {
+        if (!SelectVideoFrame(*output, frame.timestamp, frame.isKeyframe)) {
+          continue;
+        }
+        if (!serializedSize) {
+          serializedSize = SerializeVideoFrame(frame, keyframeMetadata, serializedMsg);
+        }
+        WriteVideoFrame(*output, frameNumber, frame.timestamp, frame.isKeyframe,
+                        reinterpret_cast<const std::byte*>(serializedMsg.data()), *serializedSize);
+      }
+
+      frameNumber++;
+    });
+    if (!result) {
+      spdlog::error("Failed to extract video frames from \"{}\"", inputFilename);
+    }
+  }
+
+  // The outputs are closed even after a failure, so what was converted stays readable
+  bool ok = true;
+  for (auto& output : outputs) {
+    ok = CloseVideoOutput(*output) && ok;
+  }
+  return ok && result;
+}
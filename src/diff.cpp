@@ -0,0 +1,630 @@
+#include "diff.hpp"
+
+#include <mcap/mcap.hpp>
+#include <spdlog/spdlog.h>
+#include <xxhash.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk.hpp"
+#include "threadpool.hpp"
+
+// What is compared for each message. Times and sizes are compared exactly, the data by its hash
+struct MessageDigest {
+  mcap::Timestamp logTime = 0;
+  mcap::Timestamp publishTime = 0;
+  uint64_t size = 0;
+  uint64_t hash = 0;
+
+  bool operator==(const MessageDigest& other) const = default;
+};
+
+// One MCAP file of an input. The summary is read through `reader`, and workers read chunks with
+// pread on the descriptor of the same file, so they never share the reader's buffer
+struct DiffFile {
+  std::string filename;
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> file{nullptr, std::fclose};
+  std::unique_ptr<mcap::FileReader> input;
+  // After the summary is read, only used by the one task reading an unchunked file
+  mcap::McapReader reader;
+  // Sorted by offset, which is the order messages of a channel are compared in
+  std::vector<mcap::ChunkIndex> chunkIndexes;
+  // Channel ID to index into the topic list shared by both inputs
+  std::unordered_map<mcap::ChannelId, size_t> topics;
+
+  int fd() const {
+    return fileno(file.get());
+  }
+};
+
+// A chunk of a file, or a whole unchunked file if `chunkIndex` is null
+struct DiffUnit {
+  DiffFile* file = nullptr;
+  const mcap::ChunkIndex* chunkIndex = nullptr;
+
+  mcap::Timestamp startTime() const {
+    return chunkIndex ? chunkIndex->messageStartTime : 0;
+  }
+};
+
+struct DiffInput {
+  std::string path;
+  std::vector<std::unique_ptr<DiffFile>> files;
+  // The chunks of all files, merged by start time while keeping the chunks of each file in order
+  std::vector<DiffUnit> units;
+};
+
+// The messages of one topic in both inputs, compared as their digests arrive
+struct TopicDiff {
+  std::string topic;
+  mcap::ChannelPtr channels[2];
+  mcap::SchemaPtr schemas[2];
+  // Digests of the input that is ahead, waiting for the same message of the other input
+  std::deque<MessageDigest> pending[2];
+  uint64_t counts[2] = {0, 0};
+  uint64_t matched = 0;
+  // The first difference has been reported, later messages are only counted
+  bool differs = false;
+
+  // Neither input is ahead, so messages added to both inputs alike keep the comparison in step
+  bool inStep() const {
+    return differs || (pending[0].empty() && pending[1].empty());
+  }
+};
+
+// The result of reading one unit of each input, or of one input only
+struct DiffTaskResult {
+  mcap::Status status;
+  std::optional<DiffUnit> units[2];
+  // Both units are chunks with the same hash, so they hold the same messages. `counts` holds the
+  // message count of each topic, and `messages[0]` their digests if the task was asked for them.
+  // Otherwise `chunkRecord` keeps the chunk so it need not be read again
+  bool identical = false;
+  bool digested = false;
+  std::vector<std::pair<size_t, uint64_t>> counts;
+  std::vector<std::byte> chunkRecord;
+  // Otherwise the (topic, digest) of each message of each unit, in file order
+  std::vector<std::pair<size_t, MessageDigest>> messages[2];
+  uint64_t decodedBytes = 0;
+};
+
+static mcap::Status ReadAt(int fd, uint64_t offset, uint64_t size, std::vector<std::byte>& buffer) {
+  buffer.resize(size);
+  uint64_t done = 0;
+  while (done < size) {
+    const ssize_t n = pread(fd, buffer.data() + done, size - done, off_t(offset + done));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return mcap::Status{mcap::StatusCode::ReadFailed,
+                          "failed to read " + std::to_string(size) + " bytes at offset " +
+                            std::to_string(offset)};
+    }
+    done += uint64_t(n);
+  }
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+static MessageDigest Digest(const mcap::Message& message) {
+  return {message.logTime, message.publishTime, message.dataSize,
+          XXH3_64bits(message.data, message.dataSize)};
+}
+
+static mcap::Status DigestMessage(const DiffFile& file, const mcap::Message& message,
+                                  std::vector<std::pair<size_t, MessageDigest>>& messages) {
+  const auto it = file.topics.find(message.channelId);
+  if (it == file.topics.end()) {
+    return mcap::Status{mcap::StatusCode::InvalidChannelId,
+                        "message on unknown channel " + std::to_string(message.channelId)};
+  }
+  messages.emplace_back(it->second, Digest(message));
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+// Digest the messages of a chunk, given the bytes of its chunk record
+static mcap::Status DigestChunk(const DiffFile& file, const std::vector<std::byte>& chunkBytes,
+                                std::vector<std::pair<size_t, MessageDigest>>& messages,
+                                uint64_t* decodedBytes) {
+  mcap::Record record;
+  mcap::Chunk chunk;
+  auto status = RecordAt(chunkBytes.data(), chunkBytes.size(), 0, &record);
+  if (status.ok()) {
+    status = mcap::McapReader::ParseChunk(record, &chunk);
+  }
+  std::vector<std::byte> decompressed;
+  const std::byte* records = nullptr;
+  if (status.ok()) {
+    status = DecompressChunk(chunk, decompressed, &records);
+  }
+  if (!status.ok()) {
+    return status;
+  }
+  *decodedBytes += chunk.uncompressedSize;
+
+  mcap::Status messageStatus;
+  status = ForEachRecord(records, chunk.uncompressedSize,
+                         [&](const mcap::Record& chunkRecord, uint64_t) {
+                           mcap::Message message;
+                           if (chunkRecord.opcode != mcap::OpCode::Message) {
+                             return true;
+                           }
+                           messageStatus = mcap::McapReader::ParseMessage(chunkRecord, &message);
+                           if (messageStatus.ok()) {
+                             messageStatus = DigestMessage(file, message, messages);
+                           }
+                           return messageStatus.ok();
+                         });
+  return status.ok() ? messageStatus : status;
+}
+
+// Digest the messages of an unchunked file with its reader
+static mcap::Status DigestFile(DiffFile& file,
+                               std::vector<std::pair<size_t, MessageDigest>>& messages) {
+  mcap::Status readStatus;
+  auto onProblem = [&](const mcap::Status& problem) {
+    readStatus = problem;
+  };
+  for (const auto& view : file.reader.readMessages(onProblem)) {
+    const auto status = DigestMessage(file, view.message, messages);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return readStatus;
+}
+
+static mcap::Status DigestUnit(const DiffUnit& unit, const std::vector<std::byte>* chunkRecord,
+                               std::vector<std::pair<size_t, MessageDigest>>& messages,
+                               uint64_t* decodedBytes) {
+  if (!unit.chunkIndex) {
+    return DigestFile(*unit.file, messages);
+  }
+  std::vector<std::byte> buffer;
+  if (!chunkRecord) {
+    const auto status = ReadAt(unit.file->fd(), unit.chunkIndex->chunkStartOffset,
+                               unit.chunkIndex->chunkLength, buffer);
+    if (!status.ok()) {
+      return status;
+    }
+    chunkRecord = &buffer;
+  }
+  return DigestChunk(*unit.file, *chunkRecord, messages, decodedBytes);
+}
+
+// Chunks whose summaries match are candidates for being identical
+static bool SameChunkIndex(const DiffUnit& a, const DiffUnit& b) {
+  return a.chunkIndex && b.chunkIndex && a.chunkIndex->chunkLength == b.chunkIndex->chunkLength &&
+         a.chunkIndex->uncompressedSize == b.chunkIndex->uncompressedSize &&
+         a.chunkIndex->messageStartTime == b.chunkIndex->messageStartTime &&
+         a.chunkIndex->messageEndTime == b.chunkIndex->messageEndTime &&
+         a.chunkIndex->compression == b.chunkIndex->compression &&
+         a.chunkIndex->messageIndexLength == b.chunkIndex->messageIndexLength;
+}
+
+// Count the messages of each topic in a chunk from its message indexes
+static mcap::Status CountMessages(const DiffUnit& unit,
+                                  std::vector<std::pair<size_t, uint64_t>>& counts) {
+  const auto& chunkIndex = *unit.chunkIndex;
+  if (chunkIndex.messageIndexOffsets.empty()) {
+    return mcap::Status{mcap::StatusCode::Success};
+  }
+  uint64_t start = std::numeric_limits<uint64_t>::max();
+  for (const auto& [channelId, offset] : chunkIndex.messageIndexOffsets) {
+    start = std::min(start, offset);
+  }
+  std::vector<std::byte> buffer;
+  auto status = ReadAt(unit.file->fd(), start, chunkIndex.messageIndexLength, buffer);
+  if (!status.ok()) {
+    return status;
+  }
+  mcap::Status indexStatus;
+  status = ForEachRecord(buffer.data(), buffer.size(), [&](const mcap::Record& record, uint64_t) {
+    mcap::MessageIndex messageIndex;
+    if (record.opcode != mcap::OpCode::MessageIndex) {
+      return true;
+    }
+    indexStatus = mcap::McapReader::ParseMessageIndex(record, &messageIndex);
+    if (!indexStatus.ok()) {
+      return false;
+    }
+    const auto it = unit.file->topics.find(messageIndex.channelId);
+    if (it == unit.file->topics.end()) {
+      indexStatus = mcap::Status{mcap::StatusCode::InvalidChannelId,
+                                 "message index for unknown channel " +
+                                   std::to_string(messageIndex.channelId)};
+      return false;
+    }
+    counts.emplace_back(it->second, messageIndex.records.size());
+    return true;
+  });
+  return status.ok() ? indexStatus : status;
+}
+
+// Whether the channel IDs used in a chunk map to the same topics in both files
+static bool SameTopics(const DiffUnit& a, const DiffUnit& b) {
+  for (const auto& [channelId, offset] : a.chunkIndex->messageIndexOffsets) {
+    const auto itA = a.file->topics.find(channelId);
+    const auto itB = b.file->topics.find(channelId);
+    if (itA == a.file->topics.end() || itB == b.file->topics.end() ||
+        itA->second != itB->second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Read and digest the units of a task. Runs on a worker thread. Chunks with identical contents are
+// only digested if `digestIdentical` is set, i.e. if the comparison is not in step
+static DiffTaskResult RunDiffTask(const std::optional<DiffUnit>& unitA,
+                                  const std::optional<DiffUnit>& unitB, bool digestIdentical) {
+  DiffTaskResult result;
+  result.units[0] = unitA;
+  result.units[1] = unitB;
+
+  std::vector<std::byte> chunkRecords[2];
+  if (unitA && unitB) {
+    const auto& a = *unitA;
+    const auto& b = *unitB;
+    result.status = ReadAt(a.file->fd(), a.chunkIndex->chunkStartOffset,
+                           a.chunkIndex->chunkLength, chunkRecords[0]);
+    if (result.status.ok()) {
+      result.status = ReadAt(b.file->fd(), b.chunkIndex->chunkStartOffset,
+                             b.chunkIndex->chunkLength, chunkRecords[1]);
+    }
+    if (!result.status.ok()) {
+      return result;
+    }
+    // Only fully indexed chunks can be skipped, since their message counts are needed
+    const bool indexed =
+      !a.chunkIndex->messageIndexOffsets.empty() || a.chunkIndex->uncompressedSize == 0;
+    if (indexed && SameTopics(a, b) &&
+        XXH3_64bits(chunkRecords[0].data(), chunkRecords[0].size()) ==
+          XXH3_64bits(chunkRecords[1].data(), chunkRecords[1].size())) {
+      result.identical = true;
+      result.status = CountMessages(a, result.counts);
+      if (result.status.ok() && digestIdentical) {
+        result.status =
+          DigestChunk(*a.file, chunkRecords[0], result.messages[0], &result.decodedBytes);
+        result.digested = true;
+      } else {
+        result.chunkRecord = std::move(chunkRecords[0]);
+      }
+      return result;
+    }
+  }
+
+  for (int side = 0; side < 2; side++) {
+    if (!result.units[side]) {
+      continue;
+    }
+    result.status = DigestUnit(*result.units[side],
+                               chunkRecords[side].empty() ? nullptr : &chunkRecords[side],
+                               result.messages[side], &result.decodedBytes);
+    if (!result.status.ok()) {
+      return result;
+    }
+  }
+  return result;
+}
+
+static std::string DescribeMessage(const MessageDigest& digest) {
+  return "logTime " + std::to_string(digest.logTime) + ", publishTime " +
+         std::to_string(digest.publishTime) + ", " + std::to_string(digest.size) + " bytes";
+}
+
+// Compare the next message of a topic in one input with the other input
+static void AddMessage(TopicDiff& topic, int side, const MessageDigest& digest,
+                       const std::string (&paths)[2]) {
+  topic.counts[side]++;
+  auto& other = topic.pending[1 - side];
+  if (topic.differs || !topic.channels[1 - side]) {
+    return;
+  } else if (other.empty()) {
+    topic.pending[side].push_back(digest);
+    return;
+  }
+
+  const MessageDigest& a = side == 0 ? digest : other.front();
+  const MessageDigest& b = side == 0 ? other.front() : digest;
+  if (a == b) {
+    topic.matched++;
+    other.pop_front();
+    return;
+  }
+  spdlog::warn("{}: message {} differs{}", topic.topic, topic.matched,
+               a.size == b.size && a.hash != b.hash ? " in its data" : "");
+  spdlog::warn("  {}: {}", paths[0], DescribeMessage(a));
+  spdlog::warn("  {}: {}", paths[1], DescribeMessage(b));
+  topic.differs = true;
+  topic.pending[0].clear();
+  topic.pending[1].clear();
+}
+
+// Open the MCAP files of an input and register their channels in `topics`
+static bool OpenInput(const std::string& path, int side, DiffInput& input,
+                      std::vector<TopicDiff>& topics,
+                      std::unordered_map<std::string, size_t>& topicIndexes) {
+  input.path = path;
+  std::vector<std::string> filenames;
+  std::error_code ec;
+  if (std::filesystem::is_directory(path, ec)) {
+    for (const auto& entry : std::filesystem::directory_iterator(path, ec)) {
+      if (entry.path().extension() == ".mcap" && entry.path().filename() != "index.mcap") {
+        filenames.push_back(entry.path().string());
+      }
+    }
+    std::sort(filenames.begin(), filenames.end());
+    if (filenames.empty()) {
+      spdlog::error("No MCAP files found in {}", path);
+      return false;
+    }
+  } else {
+    filenames.push_back(path);
+  }
+
+  for (const auto& filename : filenames) {
+    auto file = std::make_unique<DiffFile>();
+    file->filename = filename;
+    file->file.reset(std::fopen(filename.c_str(), "rb"));
+    if (!file->file) {
+      spdlog::error("Failed to open {}: {}", filename, std::strerror(errno));
+      return false;
+    }
+    file->input = std::make_unique<mcap::FileReader>(file->file.get());
+    auto status = file->reader.open(*file->input);
+    if (status.ok()) {
+      status = file->reader.readSummary(mcap::ReadSummaryMethod::AllowFallbackScan);
+    }
+    if (!status.ok()) {
+      spdlog::error("Failed to read {}: {}", filename, status.message);
+      return false;
+    }
+
+    file->chunkIndexes = file->reader.chunkIndexes();
+    std::sort(file->chunkIndexes.begin(), file->chunkIndexes.end(),
+              [](const auto& a, const auto& b) {
+                return a.chunkStartOffset < b.chunkStartOffset;
+              });
+    for (const auto& [channelId, channel] : file->reader.channels()) {
+      auto [it, inserted] = topicIndexes.emplace(channel->topic, topics.size());
+      if (inserted) {
+        topics.emplace_back().topic = channel->topic;
+      }
+      auto& topic = topics[it->second];
+      if (!topic.channels[side]) {
+        topic.channels[side] = channel;
+        topic.schemas[side] = file->reader.schema(channel->schemaId);
+      }
+      file->topics.emplace(channelId, it->second);
+    }
+    input.files.push_back(std::move(file));
+  }
+
+  // Unchunked files are read as a whole first, then the chunks of all files follow by start time
+  std::vector<size_t> next(input.files.size(), 0);
+  for (const auto& file : input.files) {
+    if (file->chunkIndexes.empty()) {
+      input.units.push_back({file.get(), nullptr});
+    }
+  }
+  while (true) {
+    std::optional<size_t> earliest;
+    for (size_t i = 0; i < input.files.size(); i++) {
+      const auto& chunkIndexes = input.files[i]->chunkIndexes;
+      if (next[i] < chunkIndexes.size() &&
+          (!earliest || chunkIndexes[next[i]].messageStartTime <
+                          input.files[*earliest]->chunkIndexes[next[*earliest]].messageStartTime)) {
+        earliest = i;
+      }
+    }
+    if (!earliest) {
+      break;
+    }
+    const auto& file = input.files[*earliest];
+    input.units.push_back({file.get(), &file->chunkIndexes[next[*earliest]++]});
+  }
+  return true;
+}
+
+// Report topics that are missing from one input or have a different encoding or schema
+static bool CompareChannels(const std::vector<TopicDiff>& topics, const std::string (&paths)[2]) {
+  bool same = true;
+  for (const auto& topic : topics) {
+    for (int side = 0; side < 2; side++) {
+      if (!topic.channels[1 - side]) {
+        spdlog::warn("{}: only in {}", topic.topic, paths[side]);
+        same = false;
+        break;
+      }
+    }
+    if (!topic.channels[0] || !topic.channels[1]) {
+      continue;
+    }
+    if (topic.channels[0]->messageEncoding != topic.channels[1]->messageEncoding) {
+      spdlog::warn("{}: message encoding {} != {}", topic.topic,
+                   topic.channels[0]->messageEncoding, topic.channels[1]->messageEncoding);
+      same = false;
+    }
+    const auto& schemaA = topic.schemas[0];
+    const auto& schemaB = topic.schemas[1];
+    if (bool(schemaA) != bool(schemaB) ||
+        (schemaA && (schemaA->name != schemaB->name || schemaA->encoding != schemaB->encoding ||
+                     schemaA->data != schemaB->data))) {
+      spdlog::warn("{}: schema {} != {}", topic.topic, schemaA ? schemaA->name : "(none)",
+                   schemaB ? schemaB->name : "(none)");
+      same = false;
+    }
+  }
+  return same;
+}
+
+DiffResult Diff(const std::string& pathA, const std::string& pathB, const DiffOptions& options) {
+  const std::string paths[2] = {pathA, pathB};
+  DiffInput inputs[2];
+  std::vector<TopicDiff> topics;
+  std::unordered_map<std::string, size_t> topicIndexes;
+  for (int side = 0; side < 2; side++) {
+    if (!OpenInput(paths[side], side, inputs[side], topics, topicIndexes)) {
+      return DiffResult::Error;
+    }
+  }
+  bool same = CompareChannels(topics, paths);
+
+  auto interrupted = [&]() {
+    return options.interrupt && options.interrupt->load();
+  };
+
+  const auto startTime = std::chrono::steady_clock::now();
+  uint64_t decodedBytes = 0;
+  size_t identicalChunks = 0;
+  size_t decodedUnits = 0;
+  bool ok = true;
+
+  // Feed the digests of a unit to the topic comparisons. Units of the same input arrive in order,
+  // so each topic sees its messages in file order
+  auto addMessages = [&](int side, const std::vector<std::pair<size_t, MessageDigest>>& messages) {
+    for (const auto& [topicIndex, digest] : messages) {
+      AddMessage(topics[topicIndex], side, digest, paths);
+    }
+  };
+
+  // Read and digest units on the thread pool and compare them in order on this thread
+  ThreadPool pool{options.threads};
+  auto compareResult = [&](DiffTaskResult&& result) {
+    if (!ok) {
+      return;
+    } else if (!result.status.ok()) {
+      spdlog::error("Failed to read chunk: {}", result.status.message);
+      ok = false;
+      return;
+    }
+
+    if (result.identical) {
+      // Identical chunks add the same messages to both inputs, which only keeps the comparison of
+      // a topic in step if neither input was ahead. Otherwise their messages are compared after all
+      const bool aligned =
+        std::all_of(result.counts.begin(), result.counts.end(), [&](const auto& count) {
+          return topics[count.first].inStep();
+        });
+      if (aligned) {
+        for (const auto& [topicIndex, count] : result.counts) {
+          auto& topic = topics[topicIndex];
+          topic.counts[0] += count;
+          topic.counts[1] += count;
+          topic.matched += topic.differs ? 0 : count;
+        }
+        identicalChunks++;
+        return;
+      }
+      // Tasks are asked for digests while the comparison is out of step, so this only digests
+      // chunks that were already in flight when a topic fell out of step
+      if (!result.digested) {
+        const auto status = DigestChunk(*result.units[0]->file, result.chunkRecord,
+                                        result.messages[0], &result.decodedBytes);
+        if (!status.ok()) {
+          spdlog::error("Failed to read chunk: {}", status.message);
+          ok = false;
+          return;
+        }
+      }
+      addMessages(0, result.messages[0]);
+      addMessages(1, result.messages[0]);
+      decodedUnits++;
+      decodedBytes += result.decodedBytes;
+      return;
+    }
+
+    for (int side = 0; side < 2; side++) {
+      if (result.units[side]) {
+        addMessages(side, result.messages[side]);
+        decodedUnits++;
+      }
+    }
+    decodedBytes += result.decodedBytes;
+  };
+  OrderedResults<DiffTaskResult> results{pool, pool.size() * 4, compareResult};
+
+  // Walk both inputs by chunk start time. Chunks at the same position with matching indexes are
+  // read by one task, which skips decompressing them if their contents are identical
+  size_t next[2] = {0, 0};
+  while (ok && !interrupted()) {
+    const DiffUnit* units[2] = {nullptr, nullptr};
+    for (int side = 0; side < 2; side++) {
+      if (next[side] < inputs[side].units.size()) {
+        units[side] = &inputs[side].units[next[side]];
+      }
+    }
+    std::optional<DiffUnit> taskUnits[2];
+    if (units[0] && units[1] && SameChunkIndex(*units[0], *units[1])) {
+      taskUnits[0] = *units[0];
+      taskUnits[1] = *units[1];
+    } else if (units[0] && (!units[1] || units[0]->startTime() <= units[1]->startTime())) {
+      taskUnits[0] = *units[0];
+    } else if (units[1]) {
+      taskUnits[1] = *units[1];
+    } else {
+      break;
+    }
+    for (int side = 0; side < 2; side++) {
+      next[side] += taskUnits[side] ? 1 : 0;
+    }
+
+    const bool inStep = std::all_of(topics.begin(), topics.end(), [](const auto& topic) {
+      return topic.inStep();
+    });
+    results.submit([a = taskUnits[0], b = taskUnits[1], digestIdentical = !inStep]() {
+      return RunDiffTask(a, b, digestIdentical);
+    });
+  }
+  results.finish();
+
+  if (!ok) {
+    return DiffResult::Error;
+  } else if (interrupted()) {
+    spdlog::warn("Interrupted, comparison is incomplete");
+    return DiffResult::Error;
+  }
+
+  // Messages left over on one side
+  uint64_t messageCount = 0;
+  for (const auto& topic : topics) {
+    messageCount += std::max(topic.counts[0], topic.counts[1]);
+    if (topic.differs) {
+      same = false;
+      continue;
+    } else if (!topic.channels[0] || !topic.channels[1] || topic.counts[0] == topic.counts[1]) {
+      continue;
+    }
+    const int side = topic.counts[0] > topic.counts[1] ? 0 : 1;
+    spdlog::warn("{}: {} has {} more messages, starting at message {} ({})", topic.topic,
+                 paths[side], topic.counts[side] - topic.counts[1 - side], topic.matched,
+                 DescribeMessage(topic.pending[side].front()));
+    same = false;
+  }
+
+  const double seconds =
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  spdlog::info("Compared {} messages on {} topics in {:.2f}s", messageCount, topics.size(),
+               seconds);
+  spdlog::info("Skipped {} identical chunk pairs, decoded {} chunks ({:.2f} GB/s uncompressed)",
+               identicalChunks, decodedUnits,
+               seconds > 0 ? double(decodedBytes) / seconds / 1e9 : 0.0);
+  if (same) {
+    spdlog::info("{} and {} are equivalent", pathA, pathB);
+    return DiffResult::Identical;
+  }
+  spdlog::warn("{} and {} differ", pathA, pathB);
+  return DiffResult::Different;
+}
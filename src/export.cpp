@@ -0,0 +1,779 @@
+#include "export.hpp"
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <google/protobuf/descriptor.h>
+#include <mcap/mcap.hpp>
+#include <parquet/arrow/writer.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk.hpp"
+#include "protobuf.hpp"
+#include "split.hpp"
+#include "threadpool.hpp"
+#include "wire.hpp"
+
+using google::protobuf::FieldDescriptor;
+
+// Nested messages deeper than this are not flattened, which also ends recursive message types
+constexpr int MaxNestingDepth = 8;
+// Field numbers up to this are looked up in a flat table, larger ones (e.g. extensions) in a map
+constexpr uint32_t MaxDenseFieldNumber = 1024;
+// log_time, publish_time and sequence precede the message field columns
+constexpr size_t MetadataColumns = 3;
+
+// A scalar field exported as one column
+struct ColumnPlan {
+  std::string name;
+  const FieldDescriptor* field = nullptr;
+  std::shared_ptr<arrow::DataType> type;
+  // The field default, written when a singular field is absent from a message
+  uint64_t defaultValue = 0;
+  std::string defaultBytes;
+};
+
+// How each field number of one message type is decoded
+struct MessagePlan {
+  struct Field {
+    const FieldDescriptor* descriptor = nullptr;
+    // Column of a scalar field
+    int column = -1;
+    // Plan of a singular message field, whose fields are flattened into the parent
+    std::unique_ptr<MessagePlan> nested;
+  };
+
+  std::vector<Field> dense;
+  std::unordered_map<uint32_t, Field> sparse;
+
+  const Field* find(uint32_t fieldNumber) const {
+    if (fieldNumber < dense.size()) {
+      return dense[fieldNumber].descriptor ? &dense[fieldNumber] : nullptr;
+    }
+    const auto it = sparse.find(fieldNumber);
+    return it != sparse.end() ? &it->second : nullptr;
+  }
+
+  void add(uint32_t fieldNumber, Field&& field) {
+    if (fieldNumber <= MaxDenseFieldNumber) {
+      if (fieldNumber >= dense.size()) {
+        dense.resize(fieldNumber + 1);
+      }
+      dense[fieldNumber] = std::move(field);
+    } else {
+      sparse.emplace(fieldNumber, std::move(field));
+    }
+  }
+};
+
+struct TopicPlan {
+  ProtobufSchema protobufSchema;
+  std::vector<ColumnPlan> columns;
+  MessagePlan root;
+  std::shared_ptr<arrow::Schema> schema;
+};
+
+static std::shared_ptr<arrow::DataType> ArrowType(const FieldDescriptor* field) {
+  switch (field->type()) {
+    case FieldDescriptor::TYPE_DOUBLE:
+      return arrow::float64();
+    case FieldDescriptor::TYPE_FLOAT:
+      return arrow::float32();
+    case FieldDescriptor::TYPE_INT64:
+    case FieldDescriptor::TYPE_SINT64:
+    case FieldDescriptor::TYPE_SFIXED64:
+      return arrow::int64();
+    case FieldDescriptor::TYPE_UINT64:
+    case FieldDescriptor::TYPE_FIXED64:
+      return arrow::uint64();
+    case FieldDescriptor::TYPE_INT32:
+    case FieldDescriptor::TYPE_SINT32:
+    case FieldDescriptor::TYPE_SFIXED32:
+    case FieldDescriptor::TYPE_ENUM:
+      return arrow::int32();
+    case FieldDescriptor::TYPE_UINT32:
+    case FieldDescriptor::TYPE_FIXED32:
+      return arrow::uint32();
+    case FieldDescriptor::TYPE_BOOL:
+      return arrow::boolean();
+    case FieldDescriptor::TYPE_STRING:
+      return arrow::utf8();
+    case FieldDescriptor::TYPE_BYTES:
+      return arrow::binary();
+    default:
+      return nullptr;
+  }
+}
+
+static void BuildMessagePlan(const google::protobuf::Descriptor* descriptor,
+                             const std::string& prefix, int depth,
+                             std::vector<ColumnPlan>& columns, MessagePlan& plan) {
+  for (int i = 0; i < descriptor->field_count(); i++) {
+    const auto* field = descriptor->field(i);
+    MessagePlan::Field entry;
+    entry.descriptor = field;
+    if (field->type() == FieldDescriptor::TYPE_MESSAGE) {
+      // Repeated messages (and maps) have no flat columnar form
+      if (field->is_repeated() || depth >= MaxNestingDepth) {
+        continue;
+      }
+      entry.nested = std::make_unique<MessagePlan>();
+      BuildMessagePlan(field->message_type(), prefix + field->name() + ".", depth + 1, columns,
+                       *entry.nested);
+    } else if (auto type = ArrowType(field)) {
+      ColumnPlan column;
+      column.name = prefix + field->name();
+      column.field = field;
+      column.type = field->is_repeated() ? arrow::list(type) : type;
+      // Values are carried as 64 bits, see ScalarDefault(). AppendValue() converts them back to
+      // the column type
+      column.defaultValue = ScalarDefault(field);
+      if (field->cpp_type() == FieldDescriptor::CPPTYPE_STRING) {
+        column.defaultBytes = field->default_value_string();
+      }
+      entry.column = int(columns.size());
+      columns.push_back(std::move(column));
+    } else {
+      continue;
+    }
+    plan.add(uint32_t(field->number()), std::move(entry));
+  }
+}
+
+static std::shared_ptr<TopicPlan> BuildTopicPlan(ProtobufSchema protobufSchema) {
+  auto plan = std::make_shared<TopicPlan>();
+  plan->protobufSchema = std::move(protobufSchema);
+  BuildMessagePlan(plan->protobufSchema.descriptor, "", 0, plan->columns, plan->root);
+
+  arrow::FieldVector fields{
+    arrow::field("log_time", arrow::timestamp(arrow::TimeUnit::NANO), false),
+    arrow::field("publish_time", arrow::timestamp(arrow::TimeUnit::NANO), false),
+    arrow::field("sequence", arrow::uint32(), false),
+  };
+  for (const auto& column : plan->columns) {
+    fields.push_back(arrow::field(column.name, column.type, false));
+  }
+  plan->schema = arrow::schema(std::move(fields));
+  return plan;
+}
+
+static arrow::Status AppendValue(arrow::ArrayBuilder* builder, const FieldDescriptor* field,
+                                 uint64_t value, std::string_view bytes) {
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return static_cast<arrow::Int32Builder*>(builder)->Append(int32_t(int64_t(value)));
+    case FieldDescriptor::CPPTYPE_INT64:
+      return static_cast<arrow::Int64Builder*>(builder)->Append(int64_t(value));
+    case FieldDescriptor::CPPTYPE_UINT32:
+      return static_cast<arrow::UInt32Builder*>(builder)->Append(uint32_t(value));
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return static_cast<arrow::UInt64Builder*>(builder)->Append(value);
+    case FieldDescriptor::CPPTYPE_DOUBLE: {
+      double number = 0;
+      std::memcpy(&number, &value, sizeof(number));
+      return static_cast<arrow::DoubleBuilder*>(builder)->Append(number);
+    }
+    case FieldDescriptor::CPPTYPE_FLOAT: {
+      const auto bits = uint32_t(value);
+      float number = 0;
+      std::memcpy(&number, &bits, sizeof(number));
+      return static_cast<arrow::FloatBuilder*>(builder)->Append(number);
+    }
+    case FieldDescriptor::CPPTYPE_BOOL:
+      return static_cast<arrow::BooleanBuilder*>(builder)->Append(value != 0);
+    case FieldDescriptor::CPPTYPE_STRING:
+      // StringBuilder derives from BinaryBuilder
+      return static_cast<arrow::BinaryBuilder*>(builder)->Append(bytes);
+    default:
+      return arrow::Status::TypeError("unsupported field type for ", field->full_name());
+  }
+}
+
+// Read one non-length-delimited scalar, normalized as described for ScalarDefault()
+static bool ReadScalar(const FieldDescriptor* field, WireType wireType, const std::byte*& pos,
+                       const std::byte* end, uint64_t& value) {
+  switch (wireType) {
+    case WireType::Varint:
+      if (!ReadVarint(pos, end, value)) {
+        return false;
+      }
+      break;
+    case WireType::Fixed32: {
+      uint32_t fixed = 0;
+      if (!ReadFixed32(pos, end, fixed)) {
+        return false;
+      }
+      value = fixed;
+      break;
+    }
+    case WireType::Fixed64:
+      if (!ReadFixed64(pos, end, value)) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+
+  switch (field->type()) {
+    case FieldDescriptor::TYPE_SINT32:
+    case FieldDescriptor::TYPE_SINT64:
+      value = uint64_t(ZigZagDecode(value));
+      break;
+    case FieldDescriptor::TYPE_SFIXED32:
+      value = uint64_t(int64_t(int32_t(uint32_t(value))));
+      break;
+    default:
+      break;
+  }
+  return true;
+}
+
+/**
+ * Decodes serialized messages of one topic into Arrow builders. A message is first scanned into
+ * per-column slots (singular fields) and a list of repeated values, both reused across messages,
+ * and only appended to the builders once it has been decoded completely. Strings and bytes are
+ * referenced in place until then, so decoding a message allocates nothing beyond builder growth.
+ */
+class TopicDecoder {
+public:
+  explicit TopicDecoder(const TopicPlan& plan)
+      : plan_(plan)
+      , slots_(plan.columns.size()) {}
+
+  arrow::Status init() {
+    for (const auto& field : plan_.schema->fields()) {
+      ARROW_ASSIGN_OR_RAISE(auto builder, arrow::MakeBuilder(field->type()));
+      builders_.push_back(std::move(builder));
+    }
+    return arrow::Status::OK();
+  }
+
+  /** Append a message as a new row. Returns false (and appends nothing) if it is malformed */
+  arrow::Result<bool> append(const mcap::Message& message) {
+    if (!decode(plan_.root, message.data, message.data + message.dataSize)) {
+      for (auto& slot : slots_) {
+        slot.set = false;
+      }
+      repeated_.clear();
+      return false;
+    }
+
+    ARROW_RETURN_NOT_OK(static_cast<arrow::TimestampBuilder*>(builders_[0].get())
+                          ->Append(int64_t(message.logTime)));
+    ARROW_RETURN_NOT_OK(static_cast<arrow::TimestampBuilder*>(builders_[1].get())
+                          ->Append(int64_t(message.publishTime)));
+    ARROW_RETURN_NOT_OK(
+      static_cast<arrow::UInt32Builder*>(builders_[2].get())->Append(message.sequence));
+
+    for (size_t i = 0; i < plan_.columns.size(); i++) {
+      const auto& column = plan_.columns[i];
+      auto* builder = builders_[MetadataColumns + i].get();
+      auto& slot = slots_[i];
+      if (column.field->is_repeated()) {
+        ARROW_RETURN_NOT_OK(static_cast<arrow::ListBuilder*>(builder)->Append());
+      } else if (slot.set) {
+        ARROW_RETURN_NOT_OK(AppendValue(builder, column.field, slot.value, slot.bytes));
+      } else {
+        ARROW_RETURN_NOT_OK(
+          AppendValue(builder, column.field, column.defaultValue, column.defaultBytes));
+      }
+      slot.set = false;
+    }
+
+    // Each list was opened above, so the values of different repeated fields can be appended in
+    // the order they appeared on the wire
+    for (const auto& repeated : repeated_) {
+      const size_t column = size_t(repeated.column);
+      auto* listBuilder =
+        static_cast<arrow::ListBuilder*>(builders_[MetadataColumns + column].get());
+      ARROW_RETURN_NOT_OK(AppendValue(listBuilder->value_builder(), plan_.columns[column].field,
+                                      repeated.value, repeated.bytes));
+    }
+    repeated_.clear();
+
+    rows_++;
+    return true;
+  }
+
+  arrow::Result<std::shared_ptr<arrow::RecordBatch>> finish() {
+    arrow::ArrayVector arrays;
+    for (auto& builder : builders_) {
+      ARROW_ASSIGN_OR_RAISE(auto array, builder->Finish());
+      arrays.push_back(std::move(array));
+    }
+    return arrow::RecordBatch::Make(plan_.schema, rows_, std::move(arrays));
+  }
+
+private:
+  struct Slot {
+    uint64_t value = 0;
+    std::string_view bytes;
+    bool set = false;
+  };
+
+  struct RepeatedValue {
+    int column;
+    uint64_t value;
+    std::string_view bytes;
+  };
+
+  bool decode(const MessagePlan& plan, const std::byte* pos, const std::byte* end) {
+    while (pos < end) {
+      uint32_t fieldNumber = 0;
+      WireType wireType{};
+      if (!ReadTag(pos, end, fieldNumber, wireType)) {
+        return false;
+      }
+      const auto* field = plan.find(fieldNumber);
+      if (!field) {
+        if (!SkipField(pos, end, wireType)) {
+          return false;
+        }
+        continue;
+      }
+
+      std::string_view payload;
+      if (field->nested) {
+        if (wireType != WireType::LengthDelimited || !ReadLengthDelimited(pos, end, payload)) {
+          return false;
+        }
+        const auto* nested = reinterpret_cast<const std::byte*>(payload.data());
+        if (!decode(*field->nested, nested, nested + payload.size())) {
+          return false;
+        }
+        continue;
+      }
+
+      const auto* descriptor = field->descriptor;
+      const WireType expected = WireTypeOf(descriptor);
+      uint64_t value = 0;
+      if (descriptor->is_repeated() && wireType == WireType::LengthDelimited &&
+          expected != WireType::LengthDelimited) {
+        // Packed repeated scalars
+        if (!ReadLengthDelimited(pos, end, payload)) {
+          return false;
+        }
+        const auto* packed = reinterpret_cast<const std::byte*>(payload.data());
+        const auto* packedEnd = packed + payload.size();
+        while (packed < packedEnd) {
+          if (!ReadScalar(descriptor, expected, packed, packedEnd, value)) {
+            return false;
+          }
+          repeated_.push_back({field->column, value, {}});
+        }
+      } else if (wireType != expected) {
+        if (!SkipField(pos, end, wireType)) {
+          return false;
+        }
+      } else {
+        if (expected == WireType::LengthDelimited) {
+          if (!ReadLengthDelimited(pos, end, payload)) {
+            return false;
+          }
+        } else if (!ReadScalar(descriptor, expected, pos, end, value)) {
+          return false;
+        }
+        if (descriptor->is_repeated()) {
+          repeated_.push_back({field->column, value, payload});
+        } else {
+          slots_[size_t(field->column)] = Slot{value, payload, true};
+        }
+      }
+    }
+    return true;
+  }
+
+  const TopicPlan& plan_;
+  std::vector<std::unique_ptr<arrow::ArrayBuilder>> builders_;
+  std::vector<Slot> slots_;
+  std::vector<RepeatedValue> repeated_;
+  int64_t rows_ = 0;
+};
+
+// Chunk (or run of unchunked message records) handed to a worker. `chunk.records` points into
+// `data`
+struct ExportBlock {
+  std::vector<std::byte> data;
+  mcap::Chunk chunk{};
+};
+
+struct DecodedBlock {
+  arrow::Status status;
+  // Indexed by topic, null for topics without messages in the block
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+  uint64_t malformed = 0;
+};
+
+struct ExportTopic {
+  std::string topic;
+  std::string filename;
+  std::shared_ptr<TopicPlan> plan;
+  std::shared_ptr<arrow::io::FileOutputStream> stream;
+  std::unique_ptr<parquet::arrow::FileWriter> parquetWriter;
+  std::shared_ptr<arrow::ipc::RecordBatchWriter> ipcWriter;
+  std::vector<std::shared_ptr<arrow::RecordBatch>> pending;
+  int64_t pendingRows = 0;
+  int64_t rows = 0;
+};
+
+static DecodedBlock DecodeBlock(const ExportBlock& block, const std::vector<ExportTopic>& topics,
+                                const std::unordered_map<mcap::ChannelId, size_t>& channelTopics) {
+  DecodedBlock result;
+  result.batches.resize(topics.size());
+
+  std::vector<std::byte> buffer;
+  const std::byte* records = nullptr;
+  auto status = DecompressChunk(block.chunk, buffer, &records);
+  if (!status.ok()) {
+    result.status = arrow::Status::IOError(status.message);
+    return result;
+  }
+
+  std::vector<std::unique_ptr<TopicDecoder>> decoders(topics.size());
+  status = ForEachRecord(records, block.chunk.uncompressedSize,
+                         [&](const mcap::Record& record, uint64_t) {
+                           if (record.opcode != mcap::OpCode::Message) {
+                             return true;
+                           }
+                           mcap::Message message;
+                           if (!mcap::McapReader::ParseMessage(record, &message).ok()) {
+                             result.malformed++;
+                             return true;
+                           }
+                           const auto it = channelTopics.find(message.channelId);
+                           if (it == channelTopics.end()) {
+                             return true;
+                           }
+                           auto& decoder = decoders[it->second];
+                           if (!decoder) {
+                             decoder = std::make_unique<TopicDecoder>(*topics[it->second].plan);
+                             result.status = decoder->init();
+                             if (!result.status.ok()) {
+                               return false;
+                             }
+                           }
+                           const auto appended = decoder->append(message);
+                           if (!appended.ok()) {
+                             result.status = appended.status();
+                             return false;
+                           } else if (!*appended) {
+                             result.malformed++;
+                           }
+                           return true;
+                         });
+  if (!status.ok()) {
+    result.status = arrow::Status::IOError(status.message);
+  }
+  if (!result.status.ok()) {
+    return result;
+  }
+
+  for (size_t i = 0; i < decoders.size(); i++) {
+    if (decoders[i]) {
+      auto batch = decoders[i]->finish();
+      if (!batch.ok()) {
+        result.status = batch.status();
+        return result;
+      }
+      result.batches[i] = std::move(*batch);
+    }
+  }
+  return result;
+}
+
+static arrow::Status OpenTopicOutput(ExportTopic& topic, const ExportOptions& options) {
+  ARROW_ASSIGN_OR_RAISE(topic.stream, arrow::io::FileOutputStream::Open(topic.filename));
+  if (options.format == ExportFormat::Parquet) {
+    auto properties = parquet::WriterProperties::Builder()
+                        .compression(parquet::Compression::ZSTD)
+                        ->max_row_group_length(int64_t(options.batchSize))
+                        ->build();
+    ARROW_ASSIGN_OR_RAISE(topic.parquetWriter,
+                          parquet::arrow::FileWriter::Open(*topic.plan->schema,
+                                                           arrow::default_memory_pool(),
+                                                           topic.stream, properties));
+  } else {
+    ARROW_ASSIGN_OR_RAISE(topic.ipcWriter,
+                          arrow::ipc::MakeFileWriter(topic.stream, topic.plan->schema));
+  }
+  return arrow::Status::OK();
+}
+
+// Write the batches decoded so far as one row group (Parquet) or record batch (Arrow IPC)
+static arrow::Status FlushTopicOutput(ExportTopic& topic, const ExportOptions& options) {
+  if (topic.pending.empty()) {
+    return arrow::Status::OK();
+  }
+  ARROW_ASSIGN_OR_RAISE(auto table,
+                        arrow::Table::FromRecordBatches(topic.plan->schema, topic.pending));
+  if (topic.parquetWriter) {
+    ARROW_RETURN_NOT_OK(topic.parquetWriter->WriteTable(*table, int64_t(options.batchSize)));
+  } else {
+    ARROW_ASSIGN_OR_RAISE(auto batch, table->CombineChunksToBatch());
+    ARROW_RETURN_NOT_OK(topic.ipcWriter->WriteRecordBatch(*batch));
+  }
+  topic.rows += topic.pendingRows;
+  topic.pending.clear();
+  topic.pendingRows = 0;
+  return arrow::Status::OK();
+}
+
+static arrow::Status CloseTopicOutput(ExportTopic& topic, const ExportOptions& options) {
+  ARROW_RETURN_NOT_OK(FlushTopicOutput(topic, options));
+  if (topic.parquetWriter) {
+    ARROW_RETURN_NOT_OK(topic.parquetWriter->Close());
+  } else if (topic.ipcWriter) {
+    ARROW_RETURN_NOT_OK(topic.ipcWriter->Close());
+  }
+  return topic.stream->Close();
+}
+
+static bool ChunkHasChannels(const mcap::ChunkIndex& index,
+                             const std::unordered_map<mcap::ChannelId, size_t>& channelTopics) {
+  // A chunk written without message indexes may hold any channel
+  if (index.messageIndexOffsets.empty()) {
+    return index.uncompressedSize > 0;
+  }
+  for (const auto& [channelId, offset] : index.messageIndexOffsets) {
+    if (channelTopics.count(channelId) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Export(const std::string& inputFilename, const std::string& outputDir,
+            const ExportOptions& options) {
+  mcap::McapReader reader;
+  auto status = reader.open(inputFilename);
+  if (!status.ok()) {
+    spdlog::error("Failed to open input file: {}", status.message);
+    return false;
+  }
+  status = reader.readSummary(mcap::ReadSummaryMethod::AllowFallbackScan);
+  if (!status.ok()) {
+    spdlog::error("Failed to read MCAP summary: {}", status.message);
+    return false;
+  }
+
+  std::error_code ec;
+  std::filesystem::create_directories(outputDir, ec);
+  if (ec) {
+    spdlog::error("Failed to create output directory {}: {}", outputDir, ec.message());
+    return false;
+  }
+
+  // Pick the protobuf channels to export, in channel ID order so filenames are deterministic
+  std::vector<mcap::ChannelPtr> channels;
+  for (const auto& [channelId, channel] : reader.channels()) {
+    channels.push_back(channel);
+  }
+  std::sort(channels.begin(), channels.end(), [](const auto& a, const auto& b) {
+    return a->id < b->id;
+  });
+
+  const char* extension = options.format == ExportFormat::Parquet ? ".parquet" : ".arrow";
+  std::vector<ExportTopic> topics;
+  std::unordered_map<mcap::ChannelId, size_t> channelTopics;
+  std::unordered_map<mcap::SchemaId, std::shared_ptr<TopicPlan>> plans;
+  std::unordered_map<std::string, size_t> filenameCounts;
+  for (const auto& channel : channels) {
+    if (!options.topics.empty() && std::find(options.topics.begin(), options.topics.end(),
+                                             channel->topic) == options.topics.end()) {
+      continue;
+    }
+    const auto schema = reader.schema(channel->schemaId);
+    if (channel->messageEncoding != "protobuf" || !schema || schema->encoding != "protobuf") {
+      spdlog::debug("Skipping non-protobuf topic {}", channel->topic);
+      continue;
+    }
+
+    auto& plan = plans[schema->id];
+    if (!plan) {
+      auto protobufSchema = LoadProtobufSchema(schema->name, schema->data.data(),
+                                               schema->data.size());
+      if (!protobufSchema) {
+        spdlog::warn("Skipping topic {}: cannot load protobuf schema {}", channel->topic,
+                     schema->name);
+        continue;
+      }
+      plan = BuildTopicPlan(std::move(*protobufSchema));
+    }
+
+    std::string filename = TopicFilename(channel->topic);
+    if (filenameCounts[filename]++ > 0) {
+      filename += "_" + std::to_string(channel->id);
+    }
+
+    ExportTopic topic;
+    topic.topic = channel->topic;
+    topic.filename = outputDir + "/" + filename + extension;
+    topic.plan = plan;
+    const auto openStatus = OpenTopicOutput(topic, options);
+    if (!openStatus.ok()) {
+      spdlog::error("Failed to open {}: {}", topic.filename, openStatus.ToString());
+      return false;
+    }
+    channelTopics.emplace(channel->id, topics.size());
+    topics.push_back(std::move(topic));
+  }
+  if (topics.empty()) {
+    spdlog::error("No protobuf topics to export in {}", inputFilename);
+    return false;
+  }
+
+  const auto startTime = std::chrono::steady_clock::now();
+  uint64_t inputBytes = 0;
+  uint64_t malformed = 0;
+  bool ok = true;
+
+  // Decode blocks on the thread pool and write them in order on this thread
+  ThreadPool pool{options.threads};
+  auto writeBlock = [&](DecodedBlock&& block) {
+    if (!block.status.ok()) {
+      spdlog::error("Failed to decode chunk: {}", block.status.ToString());
+      ok = false;
+      return;
+    }
+    malformed += block.malformed;
+    for (size_t i = 0; i < topics.size(); i++) {
+      auto& batch = block.batches[i];
+      if (!batch || batch->num_rows() == 0) {
+        continue;
+      }
+      auto& topic = topics[i];
+      topic.pendingRows += batch->num_rows();
+      topic.pending.push_back(std::move(batch));
+      if (topic.pendingRows >= int64_t(options.batchSize)) {
+        const auto flushStatus = FlushTopicOutput(topic, options);
+        if (!flushStatus.ok()) {
+          spdlog::error("Failed to write {}: {}", topic.filename, flushStatus.ToString());
+          ok = false;
+        }
+      }
+    }
+  };
+
+  OrderedResults<DecodedBlock> results{pool, pool.size() * 4, writeBlock};
+
+  auto submitBlock = [&](ExportBlock&& block) {
+    inputBytes += block.data.size();
+    results.submit([block = std::move(block), &topics, &channelTopics]() {
+      return DecodeBlock(block, topics, channelTopics);
+    });
+  };
+
+  auto interrupted = [&]() {
+    return options.interrupt && options.interrupt->load();
+  };
+
+  auto* dataSource = reader.dataSource();
+  auto chunkIndexes = reader.chunkIndexes();
+  if (!chunkIndexes.empty()) {
+    // Only read chunks that hold messages of an exported topic
+    std::sort(chunkIndexes.begin(), chunkIndexes.end(), [](const auto& a, const auto& b) {
+      return a.chunkStartOffset < b.chunkStartOffset;
+    });
+    for (const auto& index : chunkIndexes) {
+      if (!ok || interrupted()) {
+        break;
+      } else if (!ChunkHasChannels(index, channelTopics)) {
+        continue;
+      }
+      mcap::Record record;
+      ExportBlock block;
+      status = mcap::McapReader::ReadRecord(*dataSource, index.chunkStartOffset, &record);
+      if (status.ok()) {
+        status = mcap::McapReader::ParseChunk(record, &block.chunk);
+      }
+      if (!status.ok()) {
+        spdlog::error("Failed to read chunk at offset {}: {}", index.chunkStartOffset,
+                      status.message);
+        ok = false;
+        break;
+      }
+      block.data.assign(block.chunk.records, block.chunk.records + block.chunk.compressedSize);
+      block.chunk.records = block.data.data();
+      submitBlock(std::move(block));
+    }
+  } else {
+    // Without chunk indexes (unchunked files, or files without a summary), scan the data section.
+    // Unchunked messages are batched into blocks of roughly the default chunk size
+    ExportBlock loose;
+    auto submitLoose = [&]() {
+      if (!loose.data.empty()) {
+        loose.chunk.uncompressedSize = loose.data.size();
+        loose.chunk.compressedSize = loose.data.size();
+        loose.chunk.records = loose.data.data();
+        submitBlock(std::move(loose));
+        loose = ExportBlock{};
+      }
+    };
+
+    mcap::RecordReader recordReader{*dataSource, sizeof(mcap::Magic)};
+    while (ok && !interrupted()) {
+      const auto record = recordReader.next();
+      if (!record || record->opcode == mcap::OpCode::DataEnd) {
+        break;
+      } else if (record->opcode == mcap::OpCode::Chunk) {
+        submitLoose();
+        ExportBlock block;
+        status = mcap::McapReader::ParseChunk(*record, &block.chunk);
+        if (!status.ok()) {
+          spdlog::error("Failed to read chunk at offset {}: {}", recordReader.curRecordOffset(),
+                        status.message);
+          ok = false;
+          break;
+        }
+        block.data.assign(block.chunk.records, block.chunk.records + block.chunk.compressedSize);
+        block.chunk.records = block.data.data();
+        submitBlock(std::move(block));
+      } else if (record->opcode == mcap::OpCode::Message) {
+        // Re-serialize the record (opcode, length, data) so workers can treat it like chunk data
+        loose.data.push_back(std::byte(record->opcode));
+        for (int i = 0; i < 8; i++) {
+          loose.data.push_back(std::byte((record->dataSize >> (8 * i)) & 0xff));
+        }
+        loose.data.insert(loose.data.end(), record->data, record->data + record->dataSize);
+        if (loose.data.size() >= mcap::DefaultChunkSize) {
+          submitLoose();
+        }
+      }
+    }
+    submitLoose();
+  }
+
+  if (interrupted()) {
+    spdlog::info("Interrupted, finishing output files");
+  }
+  results.finish();
+
+  for (auto& topic : topics) {
+    const auto closeStatus = CloseTopicOutput(topic, options);
+    if (!closeStatus.ok()) {
+      spdlog::error("Failed to write {}: {}", topic.filename, closeStatus.ToString());
+      ok = false;
+    }
+    spdlog::debug("Exported {} rows of {} to {}", topic.rows, topic.topic, topic.filename);
+  }
+
+  if (malformed > 0) {
+    spdlog::warn("Skipped {} malformed messages", malformed);
+  }
+  const double seconds =
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  spdlog::info("Exported {} topics from {} MB of chunks in {:.2f}s", topics.size(),
+               inputBytes / (1024 * 1024), seconds);
+  return ok;
+}
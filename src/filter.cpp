@@ -0,0 +1,1263 @@
+#include "filter.hpp"
+
+#include <google/protobuf/descriptor.h>
+#include <mcap/mcap.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk.hpp"
+#include "protobuf.hpp"
+#include "threadpool.hpp"
+#include "wire.hpp"
+#include "writer.hpp"
+
+using google::protobuf::FieldDescriptor;
+
+enum class CompareOp {
+  Eq,
+  Ne,
+  Lt,
+  Le,
+  Gt,
+  Ge,
+};
+
+struct Literal {
+  enum class Type {
+    String,
+    Integer,
+    Float,
+    Bool,
+  };
+
+  Type type = Type::Integer;
+  std::string string;
+  // Integer literals are kept exact, as a magnitude and sign, in addition to `number`
+  uint64_t magnitude = 0;
+  bool negative = false;
+  double number = 0;
+  bool boolean = false;
+};
+
+// Syntax tree of a --where expression, independent of any schema
+struct Expression {
+  enum class Kind {
+    And,
+    Or,
+    Not,
+    // `path op literal`
+    Compare,
+    // A bare `path`, true if the bool field is set to true
+    Truth,
+  };
+
+  Kind kind = Kind::Compare;
+  std::unique_ptr<Expression> left;
+  std::unique_ptr<Expression> right;
+  std::string path;
+  size_t column = 0;
+  CompareOp op = CompareOp::Eq;
+  Literal literal;
+};
+
+/**
+ * Recursive descent parser for --where expressions:
+ *
+ *   or         := and ('||' and)*
+ *   and        := unary ('&&' unary)*
+ *   unary      := '!' unary | '(' or ')' | comparison
+ *   comparison := operand (op operand)?
+ *   operand    := path | string | number | 'true' | 'false'
+ *
+ * One operand of a comparison must be a field path and the other a literal.
+ */
+class ExpressionParser {
+public:
+  explicit ExpressionParser(std::string_view text)
+      : text_(text) {}
+
+  std::unique_ptr<Expression> parse() {
+    next();
+    auto expression = parseOr();
+    if (expression && token_.type != TokenType::End) {
+      return fail("unexpected " + describe(token_));
+    }
+    return expression;
+  }
+
+  /** Description of the first syntax error, set when parse() returns null */
+  const std::string& error() const {
+    return error_;
+  }
+
+private:
+  enum class TokenType {
+    End,
+    Identifier,
+    String,
+    Number,
+    LeftParen,
+    RightParen,
+    Not,
+    And,
+    Or,
+    Compare,
+    Invalid,
+  };
+
+  struct Token {
+    TokenType type = TokenType::End;
+    std::string text;
+    CompareOp op = CompareOp::Eq;
+    size_t column = 0;
+  };
+
+  std::unique_ptr<Expression> fail(const std::string& message) {
+    if (error_.empty()) {
+      error_ = message + " at column " + std::to_string(token_.column);
+    }
+    return nullptr;
+  }
+
+  static std::string describe(const Token& token) {
+    switch (token.type) {
+      case TokenType::End:
+        return "end of expression";
+      case TokenType::String:
+        return "string \"" + token.text + "\"";
+      case TokenType::Invalid:
+        return token.text;
+      default:
+        return "'" + token.text + "'";
+    }
+  }
+
+  void next() {
+    while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+      pos_++;
+    }
+    token_ = Token{};
+    token_.column = pos_ + 1;
+    if (pos_ >= text_.size()) {
+      return;
+    }
+
+    const char c = text_[pos_];
+    const char following = pos_ + 1 < text_.size() ? text_[pos_ + 1] : '\0';
+    auto symbol = [&](TokenType type, size_t length, CompareOp op = CompareOp::Eq) {
+      token_.type = type;
+      token_.text = std::string(text_.substr(pos_, length));
+      token_.op = op;
+      pos_ += length;
+    };
+
+    if (c == '(') {
+      symbol(TokenType::LeftParen, 1);
+    } else if (c == ')') {
+      symbol(TokenType::RightParen, 1);
+    } else if (c == '&' && following == '&') {
+      symbol(TokenType::And, 2);
+    } else if (c == '|' && following == '|') {
+      symbol(TokenType::Or, 2);
+    } else if (c == '=' && following == '=') {
+      symbol(TokenType::Compare, 2, CompareOp::Eq);
+    } else if (c == '!' && following == '=') {
+      symbol(TokenType::Compare, 2, CompareOp::Ne);
+    } else if (c == '<' && following == '=') {
+      symbol(TokenType::Compare, 2, CompareOp::Le);
+    } else if (c == '>' && following == '=') {
+      symbol(TokenType::Compare, 2, CompareOp::Ge);
+    } else if (c == '<') {
+      symbol(TokenType::Compare, 1, CompareOp::Lt);
+    } else if (c == '>') {
+      symbol(TokenType::Compare, 1, CompareOp::Gt);
+    } else if (c == '!') {
+      symbol(TokenType::Not, 1);
+    } else if (c == '"' || c == '\'') {
+      lexString(c);
+    } else if (std::isdigit(static_cast<unsigned char>(c)) ||
+               ((c == '-' || c == '.') && std::isdigit(static_cast<unsigned char>(following)))) {
+      const size_t start = pos_++;
+      while (pos_ < text_.size()) {
+        const char d = text_[pos_];
+        const char previous = text_[pos_ - 1];
+        if (std::isalnum(static_cast<unsigned char>(d)) || d == '.' ||
+            ((d == '-' || d == '+') && (previous == 'e' || previous == 'E'))) {
+          pos_++;
+        } else {
+          break;
+        }
+      }
+      token_.type = TokenType::Number;
+      token_.text = std::string(text_.substr(start, pos_ - start));
+    } else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+      const size_t start = pos_;
+      while (pos_ < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[pos_])) ||
+                                     text_[pos_] == '_' || text_[pos_] == '.')) {
+        pos_++;
+      }
+      token_.type = TokenType::Identifier;
+      token_.text = std::string(text_.substr(start, pos_ - start));
+    } else {
+      token_.type = TokenType::Invalid;
+      token_.text = "character '" + std::string(1, c) + "'";
+      pos_++;
+    }
+  }
+
+  void lexString(char quote) {
+    pos_++;
+    token_.type = TokenType::String;
+    while (pos_ < text_.size() && text_[pos_] != quote) {
+      char c = text_[pos_++];
+      if (c == '\\' && pos_ < text_.size()) {
+        c = text_[pos_++];
+        if (c == 'n') {
+          c = '\n';
+        } else if (c == 't') {
+          c = '\t';
+        }
+      }
+      token_.text.push_back(c);
+    }
+    if (pos_ >= text_.size()) {
+      token_.type = TokenType::Invalid;
+      token_.text = "unterminated string";
+      return;
+    }
+    pos_++;
+  }
+
+  std::unique_ptr<Expression> parseOr() {
+    auto left = parseAnd();
+    while (left && token_.type == TokenType::Or) {
+      next();
+      auto right = parseAnd();
+      if (!right) {
+        return nullptr;
+      }
+      left = combine(Expression::Kind::Or, std::move(left), std::move(right));
+    }
+    return left;
+  }
+
+  std::unique_ptr<Expression> parseAnd() {
+    auto left = parseUnary();
+    while (left && token_.type == TokenType::And) {
+      next();
+      auto right = parseUnary();
+      if (!right) {
+        return nullptr;
+      }
+      left = combine(Expression::Kind::And, std::move(left), std::move(right));
+    }
+    return left;
+  }
+
+  static std::unique_ptr<Expression> combine(Expression::Kind kind,
+                                             std::unique_ptr<Expression> left,
+                                             std::unique_ptr<Expression> right) {
+    auto expression = std::make_unique<Expression>();
+    expression->kind = kind;
+    expression->left = std::move(left);
+    expression->right = std::move(right);
+    return expression;
+  }
+
+  std::unique_ptr<Expression> parseUnary() {
+    if (token_.type == TokenType::Not) {
+      next();
+      auto operand = parseUnary();
+      if (!operand) {
+        return nullptr;
+      }
+      return combine(Expression::Kind::Not, std::move(operand), nullptr);
+    } else if (token_.type == TokenType::LeftParen) {
+      next();
+      auto inner = parseOr();
+      if (!inner) {
+        return nullptr;
+      } else if (token_.type != TokenType::RightParen) {
+        return fail("expected ')' but found " + describe(token_));
+      }
+      next();
+      return inner;
+    }
+    return parseComparison();
+  }
+
+  // An operand is either a field path (returned in `path`) or a literal
+  bool parseOperand(std::string& path, size_t& column, Literal& literal) {
+    path.clear();
+    column = token_.column;
+    if (token_.type == TokenType::Identifier) {
+      if (token_.text == "true" || token_.text == "false") {
+        literal.type = Literal::Type::Bool;
+        literal.boolean = token_.text == "true";
+      } else {
+        path = token_.text;
+        if (path.back() == '.' || path.find("..") != std::string::npos) {
+          fail("invalid field path '" + path + "'");
+          return false;
+        }
+      }
+    } else if (token_.type == TokenType::String) {
+      literal.type = Literal::Type::String;
+      literal.string = token_.text;
+    } else if (token_.type == TokenType::Number) {
+      if (!parseNumber(token_.text, literal)) {
+        fail("invalid number '" + token_.text + "'");
+        return false;
+      }
+    } else {
+      fail("expected a field or value but found " + describe(token_));
+      return false;
+    }
+    next();
+    return true;
+  }
+
+  static bool parseNumber(const std::string& text, Literal& literal) {
+    const bool negative = text[0] == '-';
+    const char* digits = text.c_str() + (negative ? 1 : 0);
+    char* end = nullptr;
+    errno = 0;
+    if (std::all_of(digits, text.c_str() + text.size(), [](char c) {
+          return std::isdigit(static_cast<unsigned char>(c));
+        })) {
+      literal.type = Literal::Type::Integer;
+      literal.magnitude = std::strtoull(digits, &end, 10);
+      literal.negative = negative && literal.magnitude != 0;
+      literal.number = negative ? -double(literal.magnitude) : double(literal.magnitude);
+      return errno == 0;
+    }
+    literal.type = Literal::Type::Float;
+    literal.number = std::strtod(text.c_str(), &end);
+    return errno == 0 && end == text.c_str() + text.size();
+  }
+
+  std::unique_ptr<Expression> parseComparison() {
+    auto expression = std::make_unique<Expression>();
+    std::string leftPath;
+    size_t leftColumn = 0;
+    Literal leftLiteral;
+    if (!parseOperand(leftPath, leftColumn, leftLiteral)) {
+      return nullptr;
+    }
+    if (token_.type != TokenType::Compare) {
+      if (leftPath.empty()) {
+        return fail("expected a comparison but found " + describe(token_));
+      }
+      expression->kind = Expression::Kind::Truth;
+      expression->path = std::move(leftPath);
+      expression->column = leftColumn;
+      return expression;
+    }
+
+    const size_t opColumn = token_.column;
+    CompareOp op = token_.op;
+    next();
+    std::string rightPath;
+    size_t rightColumn = 0;
+    Literal rightLiteral;
+    if (!parseOperand(rightPath, rightColumn, rightLiteral)) {
+      return nullptr;
+    }
+    if (leftPath.empty() == rightPath.empty()) {
+      token_.column = opColumn;
+      return fail("a comparison needs one field and one value");
+    }
+
+    expression->kind = Expression::Kind::Compare;
+    if (!leftPath.empty()) {
+      expression->path = std::move(leftPath);
+      expression->column = leftColumn;
+      expression->literal = std::move(rightLiteral);
+    } else {
+      // `value op field`: mirror the operator so the field is always on the left
+      expression->path = std::move(rightPath);
+      expression->column = rightColumn;
+      expression->literal = std::move(leftLiteral);
+      const CompareOp mirrored[] = {CompareOp::Eq, CompareOp::Ne, CompareOp::Gt,
+                                    CompareOp::Ge, CompareOp::Lt, CompareOp::Le};
+      op = mirrored[int(op)];
+    }
+    expression->op = op;
+    return expression;
+  }
+
+  std::string_view text_;
+  size_t pos_ = 0;
+  Token token_;
+  std::string error_;
+};
+
+// How a referenced field is represented once read from the wire. Signed integers (and enums) are
+// sign-extended to 64 bits, floats and doubles are kept as their bit patterns
+enum class ValueKind {
+  Int,
+  UInt,
+  Float,
+  Double,
+  Bool,
+  String,
+};
+
+// Last value seen of a referenced field in the message being scanned
+struct Slot {
+  uint64_t value = 0;
+  std::string_view bytes;
+  bool set = false;
+};
+
+// The fields to decode from one message type. Expressions reference few fields, so they are
+// looked up linearly
+struct ScanPlan {
+  struct Field {
+    uint32_t number = 0;
+    WireType wireType = WireType::Varint;
+    // Scalar fields
+    int slot = -1;
+    ValueKind kind = ValueKind::Int;
+    bool zigZag = false;
+    bool signExtend32 = false;
+    // Singular message fields containing referenced fields
+    std::unique_ptr<ScanPlan> nested;
+  };
+
+  std::vector<Field> fields;
+
+  const Field* find(uint32_t number) const {
+    for (const auto& field : fields) {
+      if (field.number == number) {
+        return &field;
+      }
+    }
+    return nullptr;
+  }
+};
+
+/**
+ * Walk the fields of a serialized message, storing the values of referenced fields in `slots`.
+ * Unreferenced fields are skipped by their wire type alone, so length-delimited payloads cost one
+ * length read however large they are. Later occurrences of a field replace earlier ones, as in
+ * protobuf parsing.
+ */
+static bool Scan(const ScanPlan& plan, const std::byte* pos, const std::byte* end,
+                 std::vector<Slot>& slots) {
+  while (pos < end) {
+    uint32_t fieldNumber = 0;
+    WireType wireType{};
+    if (!ReadTag(pos, end, fieldNumber, wireType)) {
+      return false;
+    }
+    const auto* field = plan.find(fieldNumber);
+    if (!field || wireType != field->wireType) {
+      if (!SkipField(pos, end, wireType)) {
+        return false;
+      }
+      continue;
+    }
+
+    Slot slot;
+    slot.set = true;
+    switch (wireType) {
+      case WireType::LengthDelimited: {
+        if (!ReadLengthDelimited(pos, end, slot.bytes)) {
+          return false;
+        } else if (field->nested) {
+          const auto* nested = reinterpret_cast<const std::byte*>(slot.bytes.data());
+          if (!Scan(*field->nested, nested, nested + slot.bytes.size(), slots)) {
+            return false;
+          }
+          continue;
+        }
+        break;
+      }
+      case WireType::Varint:
+        if (!ReadVarint(pos, end, slot.value)) {
+          return false;
+        }
+        break;
+      case WireType::Fixed32: {
+        uint32_t fixed = 0;
+        if (!ReadFixed32(pos, end, fixed)) {
+          return false;
+        }
+        slot.value = fixed;
+        break;
+      }
+      case WireType::Fixed64:
+        if (!ReadFixed64(pos, end, slot.value)) {
+          return false;
+        }
+        break;
+      default:
+        return false;
+    }
+
+    if (field->zigZag) {
+      slot.value = uint64_t(ZigZagDecode(slot.value));
+    } else if (field->signExtend32) {
+      slot.value = uint64_t(int64_t(int32_t(uint32_t(slot.value))));
+    } else if (field->kind == ValueKind::Bool) {
+      slot.value = slot.value != 0 ? 1 : 0;
+    }
+    slots[size_t(field->slot)] = slot;
+  }
+  return true;
+}
+
+template <typename T>
+static bool Compare(CompareOp op, const T& a, const T& b) {
+  switch (op) {
+    // Floating point fields are compared exactly, as the expression asks
+    case CompareOp::Eq:
+      return std::equal_to<T>{}(a, b);
+    case CompareOp::Ne:
+      return !std::equal_to<T>{}(a, b);
+    case CompareOp::Lt:
+      return a < b;
+    case CompareOp::Le:
+      return a <= b;
+    case CompareOp::Gt:
+      return a > b;
+    case CompareOp::Ge:
+      return a >= b;
+  }
+  return false;
+}
+
+static double AsDouble(ValueKind kind, uint64_t value) {
+  switch (kind) {
+    case ValueKind::Int:
+      return double(int64_t(value));
+    case ValueKind::Float: {
+      const auto bits = uint32_t(value);
+      float number = 0;
+      std::memcpy(&number, &bits, sizeof(number));
+      return number;
+    }
+    case ValueKind::Double: {
+      double number = 0;
+      std::memcpy(&number, &value, sizeof(number));
+      return number;
+    }
+    default:
+      return double(value);
+  }
+}
+
+// A --where expression compiled against one message type
+struct Predicate {
+  enum class Kind {
+    And,
+    Or,
+    Not,
+    Compare,
+  };
+
+  // The type both sides of a comparison are converted to
+  enum class Operand {
+    Int,
+    UInt,
+    Double,
+    String,
+  };
+
+  Kind kind = Kind::Compare;
+  std::unique_ptr<Predicate> left;
+  std::unique_ptr<Predicate> right;
+
+  int slot = -1;
+  CompareOp op = CompareOp::Eq;
+  ValueKind fieldKind = ValueKind::Int;
+  Operand operand = Operand::Int;
+  int64_t integer = 0;
+  uint64_t unsignedInteger = 0;
+  double number = 0;
+  std::string string;
+  // The result for messages without the field, i.e. of comparing the field's default value
+  bool absentResult = false;
+
+  bool compare(uint64_t value, std::string_view bytes) const {
+    switch (operand) {
+      case Operand::Int:
+        return Compare(op, int64_t(value), integer);
+      case Operand::UInt:
+        return Compare(op, value, unsignedInteger);
+      case Operand::Double:
+        return Compare(op, AsDouble(fieldKind, value), number);
+      case Operand::String:
+        return Compare(op, bytes, std::string_view{string});
+    }
+    return false;
+  }
+
+  bool evaluate(const std::vector<Slot>& slots) const {
+    switch (kind) {
+      case Kind::And:
+        return left->evaluate(slots) && right->evaluate(slots);
+      case Kind::Or:
+        return left->evaluate(slots) || right->evaluate(slots);
+      case Kind::Not:
+        return !left->evaluate(slots);
+      case Kind::Compare:
+        break;
+    }
+    const auto& value = slots[size_t(slot)];
+    return value.set ? compare(value.value, value.bytes) : absentResult;
+  }
+};
+
+struct CompiledFilter {
+  ScanPlan plan;
+  std::unique_ptr<Predicate> predicate;
+  size_t slotCount = 0;
+
+  /** Whether a serialized message matches, or an empty optional if it is malformed */
+  std::optional<bool> matches(const std::byte* data, uint64_t size,
+                              std::vector<Slot>& slots) const {
+    for (size_t i = 0; i < slotCount; i++) {
+      slots[i].set = false;
+    }
+    if (!Scan(plan, data, data + size, slots)) {
+      return std::nullopt;
+    }
+    return predicate->evaluate(slots);
+  }
+};
+
+static ValueKind FieldValueKind(const FieldDescriptor* field) {
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+    case FieldDescriptor::CPPTYPE_INT64:
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return ValueKind::Int;
+    case FieldDescriptor::CPPTYPE_UINT32:
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return ValueKind::UInt;
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      return ValueKind::Float;
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return ValueKind::Double;
+    case FieldDescriptor::CPPTYPE_BOOL:
+      return ValueKind::Bool;
+    default:
+      return ValueKind::String;
+  }
+}
+
+// Compiles a parsed expression against one message type
+class FilterCompiler {
+public:
+  explicit FilterCompiler(const google::protobuf::Descriptor* descriptor)
+      : descriptor_(descriptor) {}
+
+  std::unique_ptr<CompiledFilter> compile(const Expression& expression) {
+    auto filter = std::make_unique<CompiledFilter>();
+    filter_ = filter.get();
+    filter->predicate = compilePredicate(expression);
+    if (!filter->predicate) {
+      return nullptr;
+    }
+    filter->slotCount = slots_.size();
+    return filter;
+  }
+
+  /** Why the expression does not apply to the message type, set when compile() returns null */
+  const std::string& error() const {
+    return error_;
+  }
+
+private:
+  std::unique_ptr<Predicate> fail(const Expression& expression, const std::string& message) {
+    error_ = "'" + expression.path + "' (column " + std::to_string(expression.column) +
+             "): " + message;
+    return nullptr;
+  }
+
+  std::unique_ptr<Predicate> compilePredicate(const Expression& expression) {
+    auto predicate = std::make_unique<Predicate>();
+    switch (expression.kind) {
+      case Expression::Kind::And:
+      case Expression::Kind::Or:
+        predicate->kind =
+          expression.kind == Expression::Kind::And ? Predicate::Kind::And : Predicate::Kind::Or;
+        predicate->left = compilePredicate(*expression.left);
+        predicate->right = predicate->left ? compilePredicate(*expression.right) : nullptr;
+        return predicate->right ? std::move(predicate) : nullptr;
+      case Expression::Kind::Not:
+        predicate->kind = Predicate::Kind::Not;
+        predicate->left = compilePredicate(*expression.left);
+        return predicate->left ? std::move(predicate) : nullptr;
+      case Expression::Kind::Compare:
+      case Expression::Kind::Truth:
+        break;
+    }
+
+    const FieldDescriptor* field = nullptr;
+    if (!resolve(expression, field, predicate->slot)) {
+      return nullptr;
+    }
+    predicate->kind = Predicate::Kind::Compare;
+    predicate->fieldKind = FieldValueKind(field);
+
+    Literal literal = expression.literal;
+    predicate->op = expression.op;
+    if (expression.kind == Expression::Kind::Truth) {
+      if (predicate->fieldKind != ValueKind::Bool) {
+        return fail(expression, "only bool fields can be used without a comparison");
+      }
+      literal.type = Literal::Type::Bool;
+      literal.boolean = true;
+      predicate->op = CompareOp::Eq;
+    }
+
+    if (!setOperand(expression, field, literal, *predicate)) {
+      return nullptr;
+    }
+    std::string_view defaultBytes;
+    if (field->cpp_type() == FieldDescriptor::CPPTYPE_STRING) {
+      defaultBytes = field->default_value_string();
+    }
+    predicate->absentResult = predicate->compare(ScalarDefault(field), defaultBytes);
+    return predicate;
+  }
+
+  // Choose how the field and the literal are compared, converting the literal once here
+  bool setOperand(const Expression& expression, const FieldDescriptor* field,
+                  const Literal& literal, Predicate& predicate) {
+    using Operand = Predicate::Operand;
+    const bool numeric = literal.type == Literal::Type::Integer ||
+                         literal.type == Literal::Type::Float;
+    switch (predicate.fieldKind) {
+      case ValueKind::String:
+        if (literal.type != Literal::Type::String) {
+          fail(expression, "a string field must be compared with a string");
+          return false;
+        }
+        predicate.operand = Operand::String;
+        predicate.string = literal.string;
+        return true;
+      case ValueKind::Bool:
+        if (literal.type != Literal::Type::Bool) {
+          fail(expression, "a bool field must be compared with true or false");
+          return false;
+        } else if (predicate.op != CompareOp::Eq && predicate.op != CompareOp::Ne) {
+          fail(expression, "bool fields only support == and !=");
+          return false;
+        }
+        predicate.operand = Operand::UInt;
+        predicate.unsignedInteger = literal.boolean ? 1 : 0;
+        return true;
+      case ValueKind::Int:
+        if (literal.type == Literal::Type::String && field->enum_type()) {
+          const auto* value = field->enum_type()->FindValueByName(literal.string);
+          if (!value) {
+            fail(expression, "enum " + field->enum_type()->full_name() + " has no value " +
+                               literal.string);
+            return false;
+          }
+          predicate.operand = Operand::Int;
+          predicate.integer = value->number();
+          return true;
+        } else if (literal.type == Literal::Type::Integer &&
+                   literal.magnitude <= uint64_t(INT64_MAX) + (literal.negative ? 1 : 0)) {
+          predicate.operand = Operand::Int;
+          predicate.integer = literal.negative ? int64_t(0 - literal.magnitude)
+                                               : int64_t(literal.magnitude);
+          return true;
+        }
+        break;
+      case ValueKind::UInt:
+        if (literal.type == Literal::Type::Integer && !literal.negative) {
+          predicate.operand = Operand::UInt;
+          predicate.unsignedInteger = literal.magnitude;
+          return true;
+        }
+        break;
+      case ValueKind::Float:
+      case ValueKind::Double:
+        break;
+    }
+
+    if (!numeric) {
+      fail(expression, "a numeric field must be compared with a number");
+      return false;
+    }
+    predicate.operand = Operand::Double;
+    predicate.number = literal.number;
+    if (predicate.fieldKind == ValueKind::Float) {
+      // Compare at the precision of the field, so that `x == 0.1` matches a float 0.1
+      predicate.number = double(float(literal.number));
+    }
+    return true;
+  }
+
+  // Find the field named by a dotted path and add it to the scan plan
+  bool resolve(const Expression& expression, const FieldDescriptor*& field, int& slot) {
+    const auto existing = slots_.find(expression.path);
+    if (existing != slots_.end()) {
+      field = existing->second.first;
+      slot = existing->second.second;
+      return true;
+    }
+
+    const auto* descriptor = descriptor_;
+    ScanPlan* plan = &filter_->plan;
+    size_t start = 0;
+    while (true) {
+      const size_t dot = expression.path.find('.', start);
+      const std::string name = expression.path.substr(start, dot - start);
+      field = descriptor->FindFieldByName(name);
+      if (!field) {
+        fail(expression, descriptor->full_name() + " has no field " + name);
+        return false;
+      } else if (field->is_repeated()) {
+        fail(expression, "repeated field " + name + " cannot be filtered on");
+        return false;
+      }
+
+      const bool isMessage = field->type() == FieldDescriptor::TYPE_MESSAGE;
+      if (dot == std::string::npos && isMessage) {
+        fail(expression, name + " is a message, compare one of its fields instead");
+        return false;
+      } else if (dot != std::string::npos && !isMessage) {
+        fail(expression, name + " is not a message");
+        return false;
+      } else if (field->type() == FieldDescriptor::TYPE_GROUP) {
+        fail(expression, "group fields are not supported");
+        return false;
+      }
+
+      ScanPlan::Field* entry = nullptr;
+      for (auto& existingField : plan->fields) {
+        if (existingField.number == uint32_t(field->number())) {
+          entry = &existingField;
+        }
+      }
+      if (!entry) {
+        ScanPlan::Field added;
+        added.number = uint32_t(field->number());
+        added.wireType = WireTypeOf(field);
+        plan->fields.push_back(std::move(added));
+        entry = &plan->fields.back();
+      }
+      if (dot == std::string::npos) {
+        entry->slot = slot = int(slots_.size());
+        entry->kind = FieldValueKind(field);
+        entry->zigZag = field->type() == FieldDescriptor::TYPE_SINT32 ||
+                        field->type() == FieldDescriptor::TYPE_SINT64;
+        entry->signExtend32 = field->type() == FieldDescriptor::TYPE_SFIXED32;
+        slots_.emplace(expression.path, std::make_pair(field, slot));
+        return true;
+      }
+      if (!entry->nested) {
+        entry->nested = std::make_unique<ScanPlan>();
+      }
+      plan = entry->nested.get();
+      descriptor = field->message_type();
+      start = dot + 1;
+    }
+  }
+
+  const google::protobuf::Descriptor* descriptor_;
+  CompiledFilter* filter_ = nullptr;
+  std::map<std::string, std::pair<const FieldDescriptor*, int>> slots_;
+  std::string error_;
+};
+
+// Chunk (or run of unchunked message records) handed to a worker. `chunk.records` points into
+// `data`
+struct FilterBlock {
+  std::vector<std::byte> data;
+  mcap::Chunk chunk{};
+  // False for runs of unchunked records, which cannot be copied as a chunk
+  bool isChunk = false;
+};
+
+struct FilteredBlock {
+  mcap::Status status;
+  FilterBlock block;
+  std::vector<std::byte> buffer;
+  // Decompressed records, inside `block` or `buffer`
+  const std::byte* records = nullptr;
+  // Offsets of the matching message records, in file order
+  std::vector<uint64_t> kept;
+  // Message indexes of the chunk, set if every message in it matched
+  std::vector<mcap::MessageIndex> messageIndexes;
+  uint64_t messages = 0;
+  uint64_t malformed = 0;
+};
+
+static FilteredBlock FilterChunk(
+  FilterBlock&& block,
+  const std::unordered_map<mcap::ChannelId, const CompiledFilter*>& channelFilters,
+  size_t maxSlots) {
+  FilteredBlock result;
+  result.block = std::move(block);
+  const auto& chunk = result.block.chunk;
+  result.status = DecompressChunk(chunk, result.buffer, &result.records);
+  if (!result.status.ok()) {
+    return result;
+  }
+
+  std::vector<Slot> slots(maxSlots);
+  std::map<mcap::ChannelId, mcap::MessageIndex> messageIndexes;
+  uint64_t messageRecords = 0;
+  auto status = ForEachRecord(
+    result.records, chunk.uncompressedSize, [&](const mcap::Record& record, uint64_t offset) {
+      if (record.opcode != mcap::OpCode::Message) {
+        return true;
+      }
+      messageRecords++;
+      mcap::Message message;
+      if (!mcap::McapReader::ParseMessage(record, &message).ok()) {
+        result.malformed++;
+        return true;
+      }
+      const auto it = channelFilters.find(message.channelId);
+      if (it == channelFilters.end()) {
+        return true;
+      }
+      result.messages++;
+      const auto matches = it->second->matches(message.data, message.dataSize, slots);
+      if (!matches) {
+        result.malformed++;
+      } else if (*matches) {
+        result.kept.push_back(offset);
+        auto& messageIndex = messageIndexes[message.channelId];
+        messageIndex.channelId = message.channelId;
+        messageIndex.records.emplace_back(message.logTime, offset);
+      }
+      return true;
+    });
+  if (!status.ok()) {
+    result.status = status;
+    return result;
+  }
+
+  if (result.block.isChunk && !result.kept.empty() && result.kept.size() == messageRecords) {
+    for (auto& [channelId, messageIndex] : messageIndexes) {
+      result.messageIndexes.push_back(std::move(messageIndex));
+    }
+  }
+  return result;
+}
+
+static bool ChunkHasChannels(
+  const mcap::ChunkIndex& index,
+  const std::unordered_map<mcap::ChannelId, const CompiledFilter*>& channelFilters) {
+  // A chunk written without message indexes may hold any channel
+  if (index.messageIndexOffsets.empty()) {
+    return index.uncompressedSize > 0;
+  }
+  for (const auto& [channelId, offset] : index.messageIndexOffsets) {
+    if (channelFilters.count(channelId) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Filter(const std::string& inputFilename, const std::string& outputFilename,
+            const FilterOptions& options) {
+  ExpressionParser parser{options.where};
+  const auto expression = parser.parse();
+  if (!expression) {
+    spdlog::error("Invalid --where expression: {}", parser.error());
+    return false;
+  }
+
+  mcap::McapReader reader;
+  auto status = reader.open(inputFilename);
+  if (!status.ok()) {
+    spdlog::error("Failed to open input file: {}", status.message);
+    return false;
+  }
+  status = reader.readSummary(mcap::ReadSummaryMethod::AllowFallbackScan);
+  if (!status.ok()) {
+    spdlog::error("Failed to read MCAP summary: {}", status.message);
+    return false;
+  }
+
+  // Compile the expression once per schema, for the channels it applies to
+  std::vector<mcap::ChannelPtr> channels;
+  for (const auto& [channelId, channel] : reader.channels()) {
+    channels.push_back(channel);
+  }
+  std::sort(channels.begin(), channels.end(), [](const auto& a, const auto& b) {
+    return a->id < b->id;
+  });
+
+  std::unordered_map<mcap::SchemaId, std::unique_ptr<CompiledFilter>> filters;
+  std::unordered_map<mcap::SchemaId, std::string> compileErrors;
+  std::unordered_map<mcap::ChannelId, const CompiledFilter*> channelFilters;
+  std::vector<mcap::ChannelPtr> filteredChannels;
+  size_t maxSlots = 0;
+  for (const auto& channel : channels) {
+    const bool requested = std::find(options.topics.begin(), options.topics.end(),
+                                     channel->topic) != options.topics.end();
+    if (!options.topics.empty() && !requested) {
+      continue;
+    }
+    const auto schema = reader.schema(channel->schemaId);
+    if (channel->messageEncoding != "protobuf" || !schema || schema->encoding != "protobuf") {
+      if (requested) {
+        spdlog::error("Topic {} is not protobuf-encoded", channel->topic);
+        return false;
+      }
+      continue;
+    }
+
+    if (filters.count(schema->id) == 0 && compileErrors.count(schema->id) == 0) {
+      const auto protobufSchema = LoadProtobufSchema(schema->name, schema->data.data(),
+                                                     schema->data.size());
+      if (!protobufSchema) {
+        compileErrors[schema->id] = "cannot load protobuf schema " + schema->name;
+      } else {
+        FilterCompiler compiler{protobufSchema->descriptor};
+        auto filter = compiler.compile(*expression);
+        if (filter) {
+          maxSlots = std::max(maxSlots, filter->slotCount);
+          filters.emplace(schema->id, std::move(filter));
+        } else {
+          compileErrors[schema->id] = compiler.error();
+        }
+      }
+    }
+
+    const auto filter = filters.find(schema->id);
+    if (filter == filters.end()) {
+      if (requested) {
+        spdlog::error("Cannot filter topic {}: {}", channel->topic, compileErrors[schema->id]);
+        return false;
+      }
+      spdlog::debug("Skipping topic {}: {}", channel->topic, compileErrors[schema->id]);
+      continue;
+    }
+    channelFilters.emplace(channel->id, filter->second.get());
+    filteredChannels.push_back(channel);
+  }
+  for (const auto& topic : options.topics) {
+    if (std::none_of(channels.begin(), channels.end(), [&](const auto& channel) {
+          return channel->topic == topic;
+        })) {
+      spdlog::warn("Topic {} not found in {}", topic, inputFilename);
+    }
+  }
+  if (channelFilters.empty()) {
+    if (!compileErrors.empty()) {
+      spdlog::error("The --where expression does not apply to any topic: {}",
+                    compileErrors.begin()->second);
+    } else {
+      spdlog::error("No protobuf topics to filter in {}", inputFilename);
+    }
+    return false;
+  }
+
+  auto chunkIndexes = reader.chunkIndexes();
+  std::sort(chunkIndexes.begin(), chunkIndexes.end(), [](const auto& a, const auto& b) {
+    return a.chunkStartOffset < b.chunkStartOffset;
+  });
+
+  // Rewritten chunks use the compression of the input
+  ChunkedWriterOptions writerOptions;
+  writerOptions.profile = reader.header() ? reader.header()->profile : "";
+  if (!chunkIndexes.empty()) {
+    writerOptions.compression = mcap::McapReader::ParseCompression(chunkIndexes[0].compression)
+                                  .value_or(mcap::Compression::Zstd);
+  }
+  ChunkedWriter writer;
+  status = writer.open(outputFilename, writerOptions);
+  if (!status.ok()) {
+    spdlog::error("Failed to open output file: {}", status.message);
+    return false;
+  }
+  for (const auto& channel : filteredChannels) {
+    if (const auto schema = reader.schema(channel->schemaId)) {
+      writer.addSchema(*schema);
+    }
+    writer.addChannel(*channel);
+  }
+
+  const auto startTime = std::chrono::steady_clock::now();
+  uint64_t scannedBytes = 0;
+  uint64_t messages = 0;
+  uint64_t kept = 0;
+  uint64_t malformed = 0;
+  size_t copiedChunks = 0;
+  bool ok = true;
+
+  // Scan blocks on the thread pool and write the matching messages in order on this thread
+  ThreadPool pool{options.threads};
+  auto writeBlock = [&](FilteredBlock&& result) {
+    if (!ok) {
+      return;
+    } else if (!result.status.ok()) {
+      spdlog::error("Failed to read chunk: {}", result.status.message);
+      ok = false;
+      return;
+    }
+    const auto& chunk = result.block.chunk;
+    scannedBytes += chunk.uncompressedSize;
+    messages += result.messages;
+    malformed += result.malformed;
+    kept += result.kept.size();
+
+    if (!result.messageIndexes.empty()) {
+      // Every message matched: copy the chunk without recompressing it
+      status = writer.writeChunk(chunk, result.messageIndexes);
+      if (!status.ok()) {
+        spdlog::error("Failed to write chunk: {}", status.message);
+        ok = false;
+      }
+      copiedChunks++;
+      return;
+    }
+    for (const uint64_t offset : result.kept) {
+      mcap::Record record;
+      mcap::Message message;
+      status = RecordAt(result.records, chunk.uncompressedSize, offset, &record);
+      if (status.ok()) {
+        status = mcap::McapReader::ParseMessage(record, &message);
+      }
+      if (status.ok()) {
+        status = writer.write(message);
+      }
+      if (!status.ok()) {
+        spdlog::error("Failed to write message: {}", status.message);
+        ok = false;
+        return;
+      }
+    }
+  };
+
+  OrderedResults<FilteredBlock> results{pool, pool.size() * 4, writeBlock};
+
+  auto submitBlock = [&](FilterBlock&& block) {
+    results.submit([block = std::move(block), &channelFilters, maxSlots]() mutable {
+      return FilterChunk(std::move(block), channelFilters, maxSlots);
+    });
+  };
+
+  auto interrupted = [&]() {
+    return options.interrupt && options.interrupt->load();
+  };
+
+  auto* dataSource = reader.dataSource();
+  if (!chunkIndexes.empty()) {
+    for (const auto& index : chunkIndexes) {
+      if (!ok || interrupted()) {
+        break;
+      } else if (!ChunkHasChannels(index, channelFilters)) {
+        continue;
+      }
+      FilterBlock block;
+      block.isChunk = true;
+      status = ReadChunk(*dataSource, index, &block.chunk);
+      if (!status.ok()) {
+        spdlog::error("Failed to read chunk at offset {}: {}", index.chunkStartOffset,
+                      status.message);
+        ok = false;
+        break;
+      }
+      block.data.assign(block.chunk.records, block.chunk.records + block.chunk.compressedSize);
+      block.chunk.records = block.data.data();
+      submitBlock(std::move(block));
+    }
+  } else {
+    // Without chunk indexes (unchunked files, or files without a summary), scan the data section.
+    // Unchunked messages are batched into blocks of roughly the default chunk size
+    FilterBlock loose;
+    auto submitLoose = [&]() {
+      if (!loose.data.empty()) {
+        loose.chunk.uncompressedSize = loose.data.size();
+        loose.chunk.compressedSize = loose.data.size();
+        loose.chunk.records = loose.data.data();
+        submitBlock(std::move(loose));
+        loose = FilterBlock{};
+      }
+    };
+
+    mcap::RecordReader recordReader{*dataSource, sizeof(mcap::Magic)};
+    while (ok && !interrupted()) {
+      const auto record = recordReader.next();
+      if (!record || record->opcode == mcap::OpCode::DataEnd) {
+        break;
+      } else if (record->opcode == mcap::OpCode::Chunk) {
+        submitLoose();
+        FilterBlock block;
+        block.isChunk = true;
+        status = mcap::McapReader::ParseChunk(*record, &block.chunk);
+        if (!status.ok()) {
+          spdlog::error("Failed to read chunk at offset {}: {}", recordReader.curRecordOffset(),
+                        status.message);
+          ok = false;
+          break;
+        }
+        block.data.assign(block.chunk.records, block.chunk.records + block.chunk.compressedSize);
+        block.chunk.records = block.data.data();
+        submitBlock(std::move(block));
+      } else if (record->opcode == mcap::OpCode::Message) {
+        // Re-serialize the record (opcode, length, data) so workers can treat it like chunk data
+        loose.data.push_back(std::byte(record->opcode));
+        for (int i = 0; i < 8; i++) {
+          loose.data.push_back(std::byte((record->dataSize >> (8 * i)) & 0xff));
+        }
+        loose.data.insert(loose.data.end(), record->data, record->data + record->dataSize);
+        if (loose.data.size() >= mcap::DefaultChunkSize) {
+          submitLoose();
+        }
+      }
+    }
+    submitLoose();
+  }
+
+  if (interrupted()) {
+    spdlog::info("Interrupted, finishing output file");
+  }
+  results.finish();
+  const double seconds =
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+  // Metadata and attachments are passed through
+  status = CopyMetadataAndAttachments(reader, writer);
+  if (!status.ok()) {
+    spdlog::error("Failed to copy {}", status.message);
+    ok = false;
+  }
+
+  status = writer.close();
+  if (!status.ok()) {
+    spdlog::error("Failed to close output file: {}", status.message);
+    return false;
+  } else if (interrupted()) {
+    spdlog::warn("Interrupted, {} is incomplete", outputFilename);
+    return false;
+  }
+
+  if (malformed > 0) {
+    spdlog::warn("Skipped {} malformed messages", malformed);
+  }
+  spdlog::info("Kept {} of {} messages on {} topics ({} chunks copied unchanged)", kept, messages,
+               filteredChannels.size(), copiedChunks);
+  spdlog::info("Scanned {} MB of records in {:.2f}s ({:.2f} GB/s)", scannedBytes / (1024 * 1024),
+               seconds, seconds > 0 ? double(scannedBytes) / seconds / 1e9 : 0.0);
+  return ok;
+}
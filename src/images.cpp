@@ -0,0 +1,316 @@
+#include "images.hpp"
+
+#include <mcap/mcap.hpp>
+#include <spdlog/spdlog.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <fcntl.h>
+#include <filesystem>
+#include <optional>
+#include <unistd.h>
+#include <vector>
+
+#include "convert.hpp"
+#include "foxglove/CompressedImage.pb.h"
+#include "protobuf.hpp"
+#include "threadpool.hpp"
+#include "video.hpp"
+
+struct ImageFile {
+  std::string path;
+  std::string format;
+  uint64_t timestamp = 0;
+};
+
+// A serialized `foxglove.CompressedImage` message, produced on a worker thread
+struct SerializedImage {
+  std::string data;
+  bool ok = false;
+};
+
+static std::optional<std::string> ImageFormatFromExtension(const std::filesystem::path& path) {
+  std::string ext = path.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) {
+    return char(std::tolower(c));
+  });
+  if (ext == ".jpg" || ext == ".jpeg") {
+    return "jpeg";
+  } else if (ext == ".png") {
+    return "png";
+  } else if (ext == ".webp") {
+    return "webp";
+  }
+  return {};
+}
+
+/**
+ * Parse a timestamp in nanoseconds from a filename stem that is a Unix epoch time. Decimal numbers
+ * are seconds ("1690000000.125.jpg"). The unit of integers is inferred from their magnitude:
+ * seconds, milliseconds, microseconds or nanoseconds ("1690000000125.jpg"). Stems with any other
+ * text, and numbers below 1e9 (before 2001 in seconds) such as frame numbers ("00001.jpg"), are
+ * not timestamps.
+ */
+static std::optional<uint64_t> ParseFilenameTimestamp(const std::string& stem) {
+  const char* begin = stem.data();
+  const char* end = begin + stem.size();
+  uint64_t integer = 0;
+  const auto [ptr, ec] = std::from_chars(begin, end, integer);
+  if (ec != std::errc{} || ptr == begin || integer < 1000000000) {
+    return {};
+  }
+
+  if (ptr != end) {
+    if (*ptr != '.' || ptr + 1 == end) {
+      return {};
+    }
+    uint64_t nanos = 0;
+    int digits = 0;
+    for (const char* p = ptr + 1; p < end; p++) {
+      if (!std::isdigit(static_cast<unsigned char>(*p))) {
+        return {};
+      } else if (digits < 9) {
+        nanos = nanos * 10 + uint64_t(*p - '0');
+        digits++;
+      }
+    }
+    for (; digits < 9; digits++) {
+      nanos *= 10;
+    }
+    return integer * 1000000000 + nanos;
+  }
+
+  if (integer < 100000000000ull) {
+    return integer * 1000000000;  // seconds
+  } else if (integer < 100000000000000ull) {
+    return integer * 1000000;  // milliseconds
+  } else if (integer < 100000000000000000ull) {
+    return integer * 1000;  // microseconds
+  }
+  return integer;
+}
+
+static bool ReadWholeFile(const std::string& path, std::string& output) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  output.resize(size_t(st.st_size));
+  size_t offset = 0;
+  while (offset < output.size()) {
+    const ssize_t n = pread(fd, output.data() + offset, output.size() - offset, off_t(offset));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      close(fd);
+      return false;
+    }
+    offset += size_t(n);
+  }
+  close(fd);
+  return true;
+}
+
+static void SetImageTimestamp(foxglove::CompressedImage& image, uint64_t timestamp) {
+  image.mutable_timestamp()->set_seconds(int64_t(timestamp / 1000000000));
+  image.mutable_timestamp()->set_nanos(int32_t(timestamp % 1000000000));
+}
+
+// Read one image file and serialize it. Runs on a worker thread
+static SerializedImage SerializeImageFile(const ImageFile& file) {
+  SerializedImage result;
+  std::string data;
+  if (!ReadWholeFile(file.path, data)) {
+    spdlog::error("Failed to read \"{}\"", file.path);
+    return result;
+  }
+
+  foxglove::CompressedImage image;
+  SetImageTimestamp(image, file.timestamp);
+  image.set_frame_id("image");
+  image.set_format(file.format);
+  image.set_data(std::move(data));
+  result.data = image.SerializeAsString();
+  result.ok = true;
+  return result;
+}
+
+// Open `writer` and register the "image" topic, returning its channel ID
+static std::optional<mcap::ChannelId> OpenImageOutput(mcap::McapWriter& writer,
+                                                      const std::string& outputFilename) {
+  // Compressed images do not benefit from chunk compression
+  mcap::McapWriterOptions writerOpts{""};
+  writerOpts.compression = mcap::Compression::None;
+  writerOpts.noChunkCRC = true;
+  const auto status = writer.open(outputFilename, writerOpts);
+  if (!status.ok()) {
+    spdlog::error("Failed to open output file: {}", status.message);
+    return {};
+  }
+
+  // Create a schema for `foxglove.CompressedImage` and a channel for the "image" topic
+  mcap::Schema schema{"foxglove.CompressedImage", "protobuf",
+                      ProtobufFdSet(foxglove::CompressedImage::descriptor())};
+  writer.addSchema(schema);
+  mcap::Channel channel{"image", "protobuf", schema.id};
+  writer.addChannel(channel);
+  return channel.id;
+}
+
+static bool WriteImage(mcap::McapWriter& writer, mcap::ChannelId channelId, uint32_t sequence,
+                       uint64_t timestamp, const std::byte* data, size_t size) {
+  mcap::Message msg;
+  msg.channelId = channelId;
+  msg.sequence = sequence;
+  msg.logTime = timestamp;
+  msg.publishTime = timestamp;
+  msg.dataSize = size;
+  msg.data = data;
+  const auto status = writer.write(msg);
+  if (!status.ok()) {
+    spdlog::error("Failed to write image {} ({} bytes): {}", sequence, size, status.message);
+    return false;
+  }
+  return true;
+}
+
+bool ConvertImageDirectory(const std::string& inputDir, const std::string& outputFilename,
+                           const ConvertOptions& options) {
+  // List all image files
+  std::vector<ImageFile> files;
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(inputDir, ec)) {
+    if (!entry.is_regular_file()) {
+      continue;
+    }
+    const auto format = ImageFormatFromExtension(entry.path());
+    if (format) {
+      files.push_back(ImageFile{entry.path().string(), *format, 0});
+    }
+  }
+  if (ec) {
+    spdlog::error("Failed to list \"{}\": {}", inputDir, ec.message());
+    return false;
+  }
+  if (files.empty()) {
+    spdlog::error("No JPEG, PNG or WebP files found in \"{}\"", inputDir);
+    return false;
+  }
+
+  // Use filename timestamps if every file has one. Otherwise order files by name and space them
+  // evenly at `options.fps`
+  std::sort(files.begin(), files.end(), [](const ImageFile& a, const ImageFile& b) {
+    return a.path < b.path;
+  });
+  bool haveTimestamps = true;
+  for (auto& file : files) {
+    const auto timestamp =
+      ParseFilenameTimestamp(std::filesystem::path(file.path).stem().string());
+    if (!timestamp) {
+      haveTimestamps = false;
+      break;
+    }
+    file.timestamp = *timestamp;
+  }
+  if (haveTimestamps) {
+    std::stable_sort(files.begin(), files.end(), [](const ImageFile& a, const ImageFile& b) {
+      return a.timestamp < b.timestamp;
+    });
+  } else {
+    spdlog::debug("Not all filenames are timestamps, using {} fps", options.fps);
+    for (size_t i = 0; i < files.size(); i++) {
+      files[i].timestamp = uint64_t(double(i) * 1e9 / options.fps);
+    }
+  }
+
+  mcap::McapWriter writer;
+  const auto channelId = OpenImageOutput(writer, outputFilename);
+  if (!channelId) {
+    return false;
+  }
+
+  // Read and serialize images on the thread pool and write them in order on this thread. `pool` is
+  // declared after `files` so its workers are joined before the files they reference are destroyed
+  ThreadPool pool{options.threads};
+  uint32_t sequence = 0;
+  size_t skipped = 0;
+  bool ok = true;
+
+  auto writeImage = [&](SerializedImage&& image) {
+    const size_t index = size_t(sequence) + skipped;
+    if (!image.ok) {
+      skipped++;
+      return;
+    }
+    ok = ok && WriteImage(writer, *channelId, sequence, files[index].timestamp,
+                          reinterpret_cast<const std::byte*>(image.data.data()), image.data.size());
+    sequence++;
+  };
+  OrderedResults<SerializedImage> results{pool, pool.size() * 4, writeImage};
+
+  for (size_t i = 0; i < files.size() && ok; i++) {
+    if (options.interrupt && options.interrupt->load()) {
+      spdlog::info("Interrupted, stopping after {} of {} images", i, files.size());
+      break;
+    }
+    results.submit([&file = files[i]]() {
+      return SerializeImageFile(file);
+    });
+  }
+  results.finish();
+
+  writer.close();
+  if (skipped > 0) {
+    spdlog::warn("Skipped {} unreadable image files", skipped);
+  }
+  spdlog::info("Wrote {} images to \"{}\"", sequence, outputFilename);
+  return ok;
+}
+
+bool ConvertMjpeg(VideoSource& source, const std::string& imageFormat,
+                  const std::string& outputFilename, const ConvertOptions& options) {
+  mcap::McapWriter writer;
+  const auto channelId = OpenImageOutput(writer, outputFilename);
+  if (!channelId) {
+    return false;
+  }
+
+  // Raw MJPEG streams carry no timestamps, and libavformat would synthesize them at 25 fps
+  const bool rawStream = source.formatName() == "mjpeg";
+
+  uint32_t sequence = 0;
+  bool ok = true;
+  std::string serializedMsg;
+  const bool result = ExtractVideoFrames(source, [&](const VideoFrame& frame) {
+    const uint64_t timestamp =
+      rawStream ? uint64_t(double(sequence) * 1e9 / options.fps) : frame.timestamp;
+
+    foxglove::CompressedImage image;
+    SetImageTimestamp(image, timestamp);
+    image.set_frame_id("image");
+    image.set_format(imageFormat);
+    image.set_data(frame.data, frame.size);
+    image.SerializeToString(&serializedMsg);
+
+    ok = ok && WriteImage(writer, *channelId, sequence, timestamp,
+                          reinterpret_cast<const std::byte*>(serializedMsg.data()),
+                          serializedMsg.size());
+    sequence++;
+  });
+
+  if (!result) {
+    spdlog::error("Failed to extract MJPEG frames from \"{}\"", source.filename());
+  }
+
+  writer.close();
+  spdlog::info("Wrote {} images to \"{}\"", sequence, outputFilename);
+  return ok && result;
+}
@@ -0,0 +1,82 @@
+#include "info.hpp"
+
+#include <mcap/mcap.hpp>
+#include <spdlog/spdlog.h>
+
+#include <map>
+
+std::optional<nlohmann::json> Info(const std::string& inputFilename) {
+  mcap::McapReader reader;
+  auto status = reader.open(inputFilename);
+  if (!status.ok()) {
+    spdlog::error("Failed to open input file: {}", status.message);
+    return {};
+  }
+
+  status = reader.readSummary(mcap::ReadSummaryMethod::AllowFallbackScan);
+  if (!status.ok()) {
+    spdlog::error("Failed to read MCAP summary: {}", status.message);
+    return {};
+  }
+
+  nlohmann::json info;
+  info["filename"] = inputFilename;
+  info["size"] = reader.dataSource()->size();
+  if (reader.header()) {
+    info["profile"] = reader.header()->profile;
+    info["library"] = reader.header()->library;
+  }
+
+  std::unordered_map<mcap::ChannelId, uint64_t> channelMessageCounts;
+  if (reader.statistics()) {
+    const auto& stats = *reader.statistics();
+    info["messageCount"] = stats.messageCount;
+    info["schemaCount"] = stats.schemaCount;
+    info["channelCount"] = stats.channelCount;
+    info["attachmentCount"] = stats.attachmentCount;
+    info["metadataCount"] = stats.metadataCount;
+    info["chunkCount"] = stats.chunkCount;
+    info["startTime"] = stats.messageStartTime;
+    info["endTime"] = stats.messageEndTime;
+    info["duration"] = stats.messageEndTime - stats.messageStartTime;
+    channelMessageCounts = stats.channelMessageCounts;
+  }
+
+  // Aggregate chunk sizes by compression format
+  std::map<std::string, std::pair<uint64_t, uint64_t>> compression;
+  std::map<std::string, uint64_t> compressionChunks;
+  for (const auto& chunkIndex : reader.chunkIndexes()) {
+    const std::string name = chunkIndex.compression.empty() ? "none" : chunkIndex.compression;
+    compression[name].first += chunkIndex.compressedSize;
+    compression[name].second += chunkIndex.uncompressedSize;
+    compressionChunks[name]++;
+  }
+  info["compression"] = nlohmann::json::object();
+  for (const auto& [name, sizes] : compression) {
+    info["compression"][name] = {
+      {"chunks", compressionChunks[name]},
+      {"compressedSize", sizes.first},
+      {"uncompressedSize", sizes.second},
+    };
+  }
+
+  // List channels ordered by ID
+  std::map<mcap::ChannelId, mcap::ChannelPtr> channels;
+  for (const auto& [channelId, channelPtr] : reader.channels()) {
+    channels.emplace(channelId, channelPtr);
+  }
+  info["channels"] = nlohmann::json::array();
+  for (const auto& [channelId, channel] : channels) {
+    const auto schema = reader.schema(channel->schemaId);
+    info["channels"].push_back({
+      {"id", channelId},
+      {"topic", channel->topic},
+      {"messageEncoding", channel->messageEncoding},
+      {"schemaName", schema ? schema->name : ""},
+      {"schemaEncoding", schema ? schema->encoding : ""},
+      {"messageCount", channelMessageCounts[channelId]},
+    });
+  }
+
+  return info;
+}
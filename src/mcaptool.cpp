@@ -4,15 +4,100 @@
 #include <mcap/mcap.hpp>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <csignal>
 #include <filesystem>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "convert.hpp"
+#include "diff.hpp"
+#include "export.hpp"
+#include "filter.hpp"
+#include "info.hpp"
+#include "recompress.hpp"
+#include "serve.hpp"
+#include "sort.hpp"
 #include "split.hpp"
+#include "thin.hpp"
+
+static std::atomic<bool> g_interrupted{false};
+
+static void HandleSigint(int) {
+  g_interrupted = true;
+}
+
+// Install a SIGINT handler that asks long-running commands to finish their output cleanly. The
+// handler is installed without SA_RESTART so blocking reads on pipes return EINTR, and it resets
+// itself so a second Ctrl-C terminates immediately
+static void InstallSigintHandler() {
+  struct sigaction action {};
+  action.sa_handler = HandleSigint;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESETHAND;
+  sigaction(SIGINT, &action, nullptr);
+}
+
+// Split a "topic=value" rule at its last '=', since topics may contain '=' but values do not
+static std::optional<std::pair<std::string, std::string>> ParseTopicRule(const std::string& rule) {
+  const auto equals = rule.rfind('=');
+  if (equals == std::string::npos || equals == 0 || equals + 1 == rule.size()) {
+    std::cerr << "Invalid rule \"" << rule << "\", expected topic=value\n";
+    return {};
+  }
+  return std::make_pair(rule.substr(0, equals), rule.substr(equals + 1));
+}
+
+// Parse all of `text` as a number. Unlike std::stod and friends, trailing characters ("50abc")
+// are rejected, and so is a sign on an unsigned type ("-1")
+template <typename T>
+static std::optional<T> ParseNumber(const std::string& text) {
+  const char* end = text.data() + text.size();
+  T value{};
+  const auto [ptr, ec] = std::from_chars(text.data(), end, value);
+  if (text.empty() || ec != std::errc{} || ptr != end) {
+    return {};
+  }
+  return value;
+}
+
+// Parse a "codec[:level]" compression setting, e.g. "zstd:19"
+static bool ParseCompressionSetting(const std::string& setting, RecompressOptions& options) {
+  const auto colon = setting.find(':');
+  const std::string codec = setting.substr(0, colon);
+  if (codec == "none") {
+    options.compression = mcap::Compression::None;
+  } else if (codec == "lz4") {
+    options.compression = mcap::Compression::Lz4;
+  } else if (codec == "zstd") {
+    options.compression = mcap::Compression::Zstd;
+  } else {
+    std::cerr << "Invalid compression \"" << setting << "\", expected none, lz4 or zstd[:level]\n";
+    return false;
+  }
+  if (colon == std::string::npos) {
+    return true;
+  } else if (options.compression == mcap::Compression::None) {
+    std::cerr << "Invalid compression \"" << setting << "\", none takes no level\n";
+    return false;
+  }
+  const auto level = ParseNumber<int>(setting.substr(colon + 1));
+  if (!level) {
+    std::cerr << "Invalid compression level in \"" << setting << "\"\n";
+    return false;
+  }
+  options.compressionLevel = *level;
+  return true;
+}
 
 int main(int argc, char** argv) {
   spdlog::set_level(spdlog::level::debug);
@@ -23,14 +108,179 @@ int main(int argc, char** argv) {
   splitCommand.add_description("Split a MCAP file into multiple files grouped by channels.");
   splitCommand.add_argument("input.mcap").help("Input MCAP file to split.");
   splitCommand.add_argument("output_dir").help("Output directory to write split MCAP files to.");
+  splitCommand.add_argument("--fresh")
+    .help("Ignore the checkpoint left in output_dir by a previous run and split from the start.")
+    .default_value(false)
+    .implicit_value(true);
+
+  argparse::ArgumentParser thinCommand("thin");
+  thinCommand.add_description(
+    "Copy a MCAP file, decimating selected topics by rate or count and passing the rest through.");
+  thinCommand.add_argument("input.mcap").help("Input MCAP file to thin.");
+  thinCommand.add_argument("output.mcap").help("Output MCAP file to create.");
+  thinCommand.add_argument("--rate")
+    .help("Maximum rate for a topic as topic=Hz, e.g. /imu=50. May be repeated.")
+    .default_value(std::vector<std::string>{})
+    .append();
+  thinCommand.add_argument("--every")
+    .help("Keep every Nth message of a topic as topic=N, e.g. /camera=10. May be repeated.")
+    .default_value(std::vector<std::string>{})
+    .append();
+
+  argparse::ArgumentParser recompressCommand("recompress");
+  recompressCommand.add_description(
+    "Copy a MCAP file with its chunks recompressed, keeping chunk boundaries and indexes.");
+  recompressCommand.add_argument("input.mcap").help("Input MCAP file to recompress.");
+  recompressCommand.add_argument("output.mcap").help("Output MCAP file to create.");
+  recompressCommand.add_argument("--to")
+    .help("Chunk compression: none, lz4[:level] or zstd[:level], e.g. zstd:19.")
+    .default_value(std::string{"zstd"});
+  recompressCommand.add_argument("--min-ratio")
+    .help("Store chunks uncompressed unless they compress by at least this ratio.")
+    .default_value(1.05)
+    .scan<'g', double>();
+  recompressCommand.add_argument("--threads")
+    .help("Worker threads recompressing chunks (0 = one per hardware thread).")
+    .default_value(size_t(0))
+    .scan<'u', size_t>();
+
+  argparse::ArgumentParser filterCommand("filter");
+  filterCommand.add_description(
+    "Copy the messages of protobuf topics whose fields match an expression to a new MCAP file.");
+  filterCommand.add_argument("input.mcap").help("Input MCAP file to filter.");
+  filterCommand.add_argument("output.mcap").help("Output MCAP file to create.");
+  filterCommand.add_argument("--where")
+    .help("Expression over message fields, e.g. 'frame_id == \"cam_left\" && keyframe'.")
+    .required();
+  filterCommand.add_argument("--topic")
+    .help("Topic to filter. May be repeated; filters all topics the expression applies to by "
+          "default.")
+    .default_value(std::vector<std::string>{})
+    .append();
+  filterCommand.add_argument("--threads")
+    .help("Worker threads scanning chunks (0 = one per hardware thread).")
+    .default_value(size_t(0))
+    .scan<'u', size_t>();
+
+  argparse::ArgumentParser sortCommand("sort");
+  sortCommand.add_description(
+    "Copy a MCAP file with its messages sorted by log time, using bounded memory.");
+  sortCommand.add_argument("input.mcap").help("Input MCAP file to sort.");
+  sortCommand.add_argument("output.mcap").help("Output MCAP file to create.");
+  sortCommand.add_argument("--memory-mb")
+    .help("Megabytes of messages to buffer before spilling sorted runs to temporary files.")
+    .default_value(size_t(256))
+    .scan<'u', size_t>();
+  sortCommand.add_argument("--temp-dir")
+    .help("Directory for temporary files (default: the system temporary directory).")
+    .default_value(std::string{});
+
+  argparse::ArgumentParser diffCommand("diff");
+  diffCommand.add_description(
+    "Check whether two MCAP files or split output directories hold the same messages per topic.");
+  diffCommand.add_argument("a").help("First MCAP file or split output directory.");
+  diffCommand.add_argument("b").help("Second MCAP file or split output directory.");
+  diffCommand.add_argument("--threads")
+    .help("Worker threads reading and hashing chunks (0 = one per hardware thread).")
+    .default_value(size_t(0))
+    .scan<'u', size_t>();
 
   argparse::ArgumentParser convertCommand("convert");
-  convertCommand.add_description("Convert an MP4 video file to a MCAP file.");
-  convertCommand.add_argument("input.mp4").help("Input MP4 file to convert.");
+  convertCommand.add_description(
+    "Convert an MP4 video file, MJPEG stream or directory of images to a MCAP file.");
+  convertCommand.add_argument("input.mp4")
+    .help(
+      "Input MP4 file to convert. Use \"-\" to read from stdin, or pass a FIFO. A directory of "
+      "JPEG/PNG files named by timestamp or an MJPEG file produces foxglove.CompressedImage "
+      "messages.");
   convertCommand.add_argument("output.mcap").help("Output MCAP file to create.");
+  convertCommand.add_argument("--max-chunk-duration")
+    .help("Close and flush a chunk after this many milliseconds of video (0 = disabled).")
+    .default_value(uint64_t(0))
+    .scan<'u', uint64_t>();
+  convertCommand.add_argument("--preview")
+    .help("Also write a keyframe-only preview MCAP file from the same pass.")
+    .default_value(std::string{});
+  convertCommand.add_argument("--keyframes-only")
+    .help("Keep only keyframes in the preview (or the output, if no --preview is given).")
+    .default_value(false)
+    .implicit_value(true);
+  convertCommand.add_argument("--max-fps")
+    .help("Maximum preview frame rate; keyframes closer together are dropped. Implies "
+          "--keyframes-only.")
+    .default_value(0.0)
+    .scan<'g', double>();
+  convertCommand.add_argument("--fps")
+    .help("Frame rate for images without timestamps (raw MJPEG, non-timestamp filenames).")
+    .default_value(30.0)
+    .scan<'g', double>();
+  convertCommand.add_argument("--parallel")
+    .help("Convert GOP-aligned ranges of an indexed video file (e.g. MP4) concurrently.")
+    .default_value(false)
+    .implicit_value(true);
+  convertCommand.add_argument("--threads")
+    .help("Worker threads for image ingestion and --parallel conversion (0 = one per hardware "
+          "thread).")
+    .default_value(size_t(0))
+    .scan<'u', size_t>();
+
+  argparse::ArgumentParser exportCommand("export");
+  exportCommand.add_description(
+    "Export protobuf topics of a MCAP file to columnar Arrow IPC or Parquet files, one per topic.");
+  exportCommand.add_argument("input.mcap").help("Input MCAP file to export.");
+  exportCommand.add_argument("output_dir").help("Output directory to write one file per topic to.");
+  exportCommand.add_argument("--format")
+    .help("Output format: \"parquet\" or \"arrow\" (Arrow IPC file).")
+    .default_value(std::string{"parquet"});
+  exportCommand.add_argument("--topic")
+    .help("Topic to export. May be repeated; exports all protobuf topics by default.")
+    .default_value(std::vector<std::string>{})
+    .append();
+  exportCommand.add_argument("--batch-size")
+    .help("Rows per Parquet row group or Arrow record batch.")
+    .default_value(size_t(65536))
+    .scan<'u', size_t>();
+  exportCommand.add_argument("--threads")
+    .help("Worker threads decoding chunks (0 = one per hardware thread).")
+    .default_value(size_t(0))
+    .scan<'u', size_t>();
+
+  argparse::ArgumentParser infoCommand("info");
+  infoCommand.add_description("Print a JSON summary of a MCAP file.");
+  infoCommand.add_argument("input.mcap").help("Input MCAP file to summarize.");
+
+  argparse::ArgumentParser serveCommand("serve");
+  serveCommand.add_description(
+    "Run a resident server that executes split/convert/info jobs received as JSON on a Unix "
+    "domain socket.");
+  serveCommand.add_argument("--socket")
+    .help("Unix domain socket path to listen on.")
+    .default_value(std::string{"/tmp/mcaptool.sock"});
+  serveCommand.add_argument("--jobs")
+    .help("Maximum number of concurrent jobs (0 = one per hardware thread).")
+    .default_value(size_t(0))
+    .scan<'u', size_t>();
+
+  argparse::ArgumentParser submitCommand("submit");
+  submitCommand.add_description(
+    "Send a JSON job to a running `mcaptool serve` and print the result.");
+  submitCommand.add_argument("job")
+    .help("JSON job, e.g. '{\"command\": \"info\", \"input\": \"in.mcap\"}'.");
+  submitCommand.add_argument("--socket")
+    .help("Unix domain socket path of the server.")
+    .default_value(std::string{"/tmp/mcaptool.sock"});
 
   program.add_subparser(splitCommand);
+  program.add_subparser(thinCommand);
+  program.add_subparser(recompressCommand);
+  program.add_subparser(filterCommand);
+  program.add_subparser(sortCommand);
+  program.add_subparser(diffCommand);
   program.add_subparser(convertCommand);
+  program.add_subparser(exportCommand);
+  program.add_subparser(infoCommand);
+  program.add_subparser(serveCommand);
+  program.add_subparser(submitCommand);
 
   try {
     program.parse_args(argc, argv);
@@ -43,11 +293,145 @@ int main(int argc, char** argv) {
   if (program.is_subcommand_used("split")) {
     const std::string inputFilename = splitCommand.get("input.mcap");
     const std::string outputDir = splitCommand.get("output_dir");
-    return Split(inputFilename, outputDir) ? 0 : 1;
+    SplitOptions options;
+    options.fresh = splitCommand.get<bool>("--fresh");
+    options.interrupt = &g_interrupted;
+    InstallSigintHandler();
+    return Split(inputFilename, outputDir, options) ? 0 : 1;
+  } else if (program.is_subcommand_used("thin")) {
+    ThinOptions options;
+    for (const auto& rule : thinCommand.get<std::vector<std::string>>("--rate")) {
+      const auto parsed = ParseTopicRule(rule);
+      if (!parsed) {
+        return 1;
+      }
+      const auto rate = ParseNumber<double>(parsed->second);
+      if (!rate || !(*rate > 0) || !std::isfinite(*rate)) {
+        std::cerr << "Invalid --rate \"" << rule << "\", expected a positive rate in Hz\n";
+        return 1;
+      }
+      options.rates[parsed->first] = *rate;
+    }
+    for (const auto& rule : thinCommand.get<std::vector<std::string>>("--every")) {
+      const auto parsed = ParseTopicRule(rule);
+      if (!parsed) {
+        return 1;
+      }
+      const auto every = ParseNumber<uint64_t>(parsed->second);
+      if (!every || *every == 0) {
+        std::cerr << "Invalid --every \"" << rule << "\", expected a positive count\n";
+        return 1;
+      }
+      options.every[parsed->first] = *every;
+    }
+    options.interrupt = &g_interrupted;
+    InstallSigintHandler();
+    const std::string inputFilename = thinCommand.get("input.mcap");
+    const std::string outputFilename = thinCommand.get("output.mcap");
+    return Thin(inputFilename, outputFilename, options) ? 0 : 1;
+  } else if (program.is_subcommand_used("recompress")) {
+    RecompressOptions options;
+    if (!ParseCompressionSetting(recompressCommand.get("--to"), options)) {
+      return 1;
+    }
+    options.minRatio = recompressCommand.get<double>("--min-ratio");
+    if (!(options.minRatio > 0)) {
+      std::cerr << "Invalid --min-ratio " << options.minRatio << ", expected a positive ratio\n";
+      return 1;
+    }
+    options.threads = recompressCommand.get<size_t>("--threads");
+    options.interrupt = &g_interrupted;
+    InstallSigintHandler();
+    const std::string inputFilename = recompressCommand.get("input.mcap");
+    const std::string outputFilename = recompressCommand.get("output.mcap");
+    return Recompress(inputFilename, outputFilename, options) ? 0 : 1;
+  } else if (program.is_subcommand_used("filter")) {
+    FilterOptions options;
+    options.where = filterCommand.get("--where");
+    options.topics = filterCommand.get<std::vector<std::string>>("--topic");
+    options.threads = filterCommand.get<size_t>("--threads");
+    options.interrupt = &g_interrupted;
+    InstallSigintHandler();
+    const std::string inputFilename = filterCommand.get("input.mcap");
+    const std::string outputFilename = filterCommand.get("output.mcap");
+    return Filter(inputFilename, outputFilename, options) ? 0 : 1;
+  } else if (program.is_subcommand_used("sort")) {
+    SortOptions options;
+    options.memoryBudget = sortCommand.get<size_t>("--memory-mb") * 1024 * 1024;
+    options.tempDir = sortCommand.get("--temp-dir");
+    options.interrupt = &g_interrupted;
+    InstallSigintHandler();
+    const std::string inputFilename = sortCommand.get("input.mcap");
+    const std::string outputFilename = sortCommand.get("output.mcap");
+    return Sort(inputFilename, outputFilename, options) ? 0 : 1;
+  } else if (program.is_subcommand_used("diff")) {
+    DiffOptions options;
+    options.threads = diffCommand.get<size_t>("--threads");
+    options.interrupt = &g_interrupted;
+    InstallSigintHandler();
+    // Exit codes follow diff(1): 0 if equivalent, 1 if different, 2 on errors
+    switch (Diff(diffCommand.get("a"), diffCommand.get("b"), options)) {
+      case DiffResult::Identical:
+        return 0;
+      case DiffResult::Different:
+        return 1;
+      case DiffResult::Error:
+        break;
+    }
+    return 2;
   } else if (program.is_subcommand_used("convert")) {
     const std::string inputFilename = convertCommand.get("input.mp4");
     const std::string outputFilename = convertCommand.get("output.mcap");
-    return Convert(inputFilename, outputFilename) ? 0 : 1;
+    ConvertOptions options;
+    options.maxChunkDuration = convertCommand.get<uint64_t>("--max-chunk-duration") * 1000000;
+    options.previewFilename = convertCommand.get("--preview");
+    options.keyframesOnly = convertCommand.get<bool>("--keyframes-only");
+    options.maxFps = convertCommand.get<double>("--max-fps");
+    options.fps = convertCommand.get<double>("--fps");
+    if (!(options.fps > 0)) {
+      std::cerr << "Invalid --fps " << options.fps << ", expected a positive frame rate\n";
+      return 1;
+    }
+    options.parallel = convertCommand.get<bool>("--parallel");
+    options.threads = convertCommand.get<size_t>("--threads");
+    options.interrupt = &g_interrupted;
+    InstallSigintHandler();
+    return Convert(inputFilename, outputFilename, options) ? 0 : 1;
+  } else if (program.is_subcommand_used("export")) {
+    ExportOptions options;
+    const auto format = exportCommand.get("--format");
+    if (format == "parquet") {
+      options.format = ExportFormat::Parquet;
+    } else if (format == "arrow") {
+      options.format = ExportFormat::Arrow;
+    } else {
+      std::cerr << "Unknown export format \"" << format << "\"\n";
+      return 1;
+    }
+    options.topics = exportCommand.get<std::vector<std::string>>("--topic");
+    options.batchSize = std::max(exportCommand.get<size_t>("--batch-size"), size_t(1));
+    options.threads = exportCommand.get<size_t>("--threads");
+    options.interrupt = &g_interrupted;
+    InstallSigintHandler();
+    const std::string inputFilename = exportCommand.get("input.mcap");
+    const std::string outputDir = exportCommand.get("output_dir");
+    return Export(inputFilename, outputDir, options) ? 0 : 1;
+  } else if (program.is_subcommand_used("info")) {
+    const auto info = Info(infoCommand.get("input.mcap"));
+    if (!info) {
+      return 1;
+    }
+    std::cout << info->dump(2) << "\n";
+    return 0;
+  } else if (program.is_subcommand_used("serve")) {
+    ServeOptions options;
+    options.socketPath = serveCommand.get("--socket");
+    options.jobs = serveCommand.get<size_t>("--jobs");
+    options.interrupt = &g_interrupted;
+    InstallSigintHandler();
+    return Serve(options) ? 0 : 1;
+  } else if (program.is_subcommand_used("submit")) {
+    return Submit(submitCommand.get("--socket"), submitCommand.get("job")) ? 0 : 1;
   } else {
     // Print help
     std::cout << program;
@@ -1,8 +1,13 @@
 #include "protobuf.hpp"
 
+#include <google/protobuf/descriptor.h>
 #include <google/protobuf/descriptor.pb.h>
 
+#include <climits>
+#include <mutex>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 // Recursively adds all `fd` dependencies to `fdSet`
 static void ProtobufFdSetInternal(google::protobuf::FileDescriptorSet& fdSet,
@@ -18,9 +23,58 @@ static void ProtobufFdSetInternal(google::protobuf::FileDescriptorSet& fdSet,
 }
 
 std::string ProtobufFdSet(const google::protobuf::Descriptor* d) {
-  std::string res;
+  // Descriptors live for the lifetime of the process, so each set is only built once. This matters
+  // when many jobs run in one process (`mcaptool serve`)
+  static std::mutex mutex;
+  static std::unordered_map<const google::protobuf::Descriptor*, std::string> cache;
+  std::lock_guard<std::mutex> lock(mutex);
+  const auto it = cache.find(d);
+  if (it != cache.end()) {
+    return it->second;
+  }
+
   std::unordered_set<std::string> files;
   google::protobuf::FileDescriptorSet fdSet;
   ProtobufFdSetInternal(fdSet, files, d->file());
-  return fdSet.SerializeAsString();
+  return cache.emplace(d, fdSet.SerializeAsString()).first->second;
+}
+
+std::optional<ProtobufSchema> LoadProtobufSchema(const std::string& messageName,
+                                                 const std::byte* data, size_t size) {
+  google::protobuf::FileDescriptorSet fdSet;
+  if (size > size_t(INT_MAX) || !fdSet.ParseFromArray(data, int(size))) {
+    return {};
+  }
+
+  // Files can only be built after their dependencies. Sets written by ProtobufFdSet() are already
+  // in dependency order, but other writers make no such promise, so keep making passes over the
+  // remaining files until no more can be built
+  auto pool = std::make_shared<google::protobuf::DescriptorPool>();
+  std::vector<const google::protobuf::FileDescriptorProto*> remaining;
+  for (const auto& file : fdSet.file()) {
+    remaining.push_back(&file);
+  }
+  bool progress = true;
+  while (!remaining.empty() && progress) {
+    progress = false;
+    for (auto it = remaining.begin(); it != remaining.end();) {
+      const auto& file = **it;
+      bool ready = true;
+      for (const auto& dependency : file.dependency()) {
+        ready = ready && pool->FindFileByName(dependency) != nullptr;
+      }
+      if (ready && pool->BuildFile(file) != nullptr) {
+        it = remaining.erase(it);
+        progress = true;
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  const auto* descriptor = pool->FindMessageTypeByName(messageName);
+  if (!descriptor) {
+    return {};
+  }
+  return ProtobufSchema{std::move(pool), descriptor};
 }
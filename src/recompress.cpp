@@ -0,0 +1,249 @@
+#include "recompress.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <vector>
+
+#include "chunk.hpp"
+#include "threadpool.hpp"
+#include "writer.hpp"
+
+// A chunk read from the input and handed to a worker. `chunk.records` points into `data`
+struct RecompressBlock {
+  std::vector<std::byte> data;
+  mcap::Chunk chunk{};
+  std::vector<mcap::MessageIndex> messageIndexes;
+  // The chunk already has the target compression and is written unchanged
+  bool copy = false;
+  // The chunk already has the target compression but compresses worse than the minimum ratio, so
+  // it is stored uncompressed without compressing it again
+  bool store = false;
+};
+
+struct RecompressedBlock {
+  mcap::Status status;
+  RecompressBlock input;
+  // The chunk to write. `chunk.records` points into `input.data`, `decompressed` or `compressed`
+  mcap::Chunk chunk{};
+  std::vector<std::byte> decompressed;
+  std::vector<std::byte> compressed;
+  bool stored = false;
+};
+
+static RecompressedBlock RecompressChunk(RecompressBlock&& input,
+                                         const RecompressOptions& options) {
+  RecompressedBlock result;
+  result.input = std::move(input);
+  result.chunk = result.input.chunk;
+  if (result.input.copy) {
+    return result;
+  }
+
+  const auto& chunk = result.input.chunk;
+  const std::byte* records = nullptr;
+  result.status = DecompressChunk(chunk, result.decompressed, &records);
+  if (!result.status.ok()) {
+    return result;
+  }
+
+  // Chunks written without message indexes get them rebuilt, so the output is fully indexed
+  if (result.input.messageIndexes.empty() && chunk.uncompressedSize > 0) {
+    std::map<mcap::ChannelId, mcap::MessageIndex> messageIndexes;
+    result.status = ForEachRecord(
+      records, chunk.uncompressedSize, [&](const mcap::Record& record, uint64_t offset) {
+        mcap::Message message;
+        if (record.opcode == mcap::OpCode::Message &&
+            mcap::McapReader::ParseMessage(record, &message).ok()) {
+          auto& messageIndex = messageIndexes[message.channelId];
+          messageIndex.channelId = message.channelId;
+          messageIndex.records.emplace_back(message.logTime, offset);
+        }
+        return true;
+      });
+    if (!result.status.ok()) {
+      return result;
+    }
+    for (auto& [channelId, messageIndex] : messageIndexes) {
+      result.input.messageIndexes.push_back(std::move(messageIndex));
+    }
+  }
+
+  const std::string compression = CompressionName(options.compression);
+  if (!compression.empty() && !result.input.store) {
+    result.status = CompressChunk(compression, options.compressionLevel, records,
+                                  chunk.uncompressedSize, result.compressed);
+    if (!result.status.ok()) {
+      return result;
+    } else if (double(chunk.uncompressedSize) >=
+               double(result.compressed.size()) * options.minRatio) {
+      result.chunk.compression = compression;
+      result.chunk.compressedSize = result.compressed.size();
+      result.chunk.records = result.compressed.data();
+      return result;
+    }
+  }
+
+  // Not worth compressing
+  result.chunk.compression = "";
+  result.chunk.compressedSize = chunk.uncompressedSize;
+  result.chunk.records = records;
+  result.stored = !compression.empty();
+  return result;
+}
+
+bool Recompress(const std::string& inputFilename, const std::string& outputFilename,
+                const RecompressOptions& options) {
+  mcap::McapReader reader;
+  auto status = reader.open(inputFilename);
+  if (!status.ok()) {
+    spdlog::error("Failed to open input file: {}", status.message);
+    return false;
+  }
+  status = reader.readSummary(mcap::ReadSummaryMethod::AllowFallbackScan);
+  if (!status.ok()) {
+    spdlog::error("Failed to read MCAP summary: {}", status.message);
+    return false;
+  }
+
+  ChunkedWriterOptions writerOptions;
+  writerOptions.profile = reader.header() ? reader.header()->profile : "";
+  writerOptions.compression = options.compression;
+  writerOptions.compressionLevel = options.compressionLevel;
+  ChunkedWriter writer;
+  status = writer.open(outputFilename, writerOptions);
+  if (!status.ok()) {
+    spdlog::error("Failed to open output file: {}", status.message);
+    return false;
+  }
+  for (const auto& [schemaId, schema] : reader.schemas()) {
+    writer.addSchema(*schema);
+  }
+  for (const auto& [channelId, channel] : reader.channels()) {
+    writer.addChannel(*channel);
+  }
+
+  auto interrupted = [&]() {
+    return options.interrupt && options.interrupt->load();
+  };
+
+  const auto startTime = std::chrono::steady_clock::now();
+  const std::string compression = CompressionName(options.compression);
+  uint64_t inputBytes = 0;
+  uint64_t outputBytes = 0;
+  uint64_t uncompressedBytes = 0;
+  size_t recompressedChunks = 0;
+  size_t copiedChunks = 0;
+  size_t storedChunks = 0;
+  bool ok = true;
+
+  // Recompress chunks on the thread pool and write them in order on this thread
+  ThreadPool pool{options.threads};
+  auto writeBlock = [&](RecompressedBlock&& result) {
+    if (!ok) {
+      return;
+    } else if (!result.status.ok()) {
+      spdlog::error("Failed to recompress chunk: {}", result.status.message);
+      ok = false;
+      return;
+    }
+    status = writer.writeChunk(result.chunk, result.input.messageIndexes);
+    if (!status.ok()) {
+      spdlog::error("Failed to write chunk: {}", status.message);
+      ok = false;
+      return;
+    }
+    inputBytes += result.input.chunk.compressedSize;
+    outputBytes += result.chunk.compressedSize;
+    uncompressedBytes += result.chunk.uncompressedSize;
+    if (result.input.copy) {
+      copiedChunks++;
+    } else {
+      recompressedChunks++;
+      storedChunks += result.stored ? 1 : 0;
+    }
+  };
+  OrderedResults<RecompressedBlock> results{pool, pool.size() * 4, writeBlock};
+
+  auto* dataSource = reader.dataSource();
+  auto chunkIndexes = reader.chunkIndexes();
+  std::sort(chunkIndexes.begin(), chunkIndexes.end(), [](const auto& a, const auto& b) {
+    return a.chunkStartOffset < b.chunkStartOffset;
+  });
+  for (const auto& chunkIndex : chunkIndexes) {
+    if (!ok || interrupted()) {
+      break;
+    }
+
+    // The chunk records are copied out of the read buffer before the message indexes are read
+    RecompressBlock block;
+    status = ReadChunk(*dataSource, chunkIndex, &block.chunk);
+    if (status.ok()) {
+      block.data.assign(block.chunk.records, block.chunk.records + block.chunk.compressedSize);
+      block.chunk.records = block.data.data();
+      status = ReadMessageIndexes(*dataSource, chunkIndex, block.messageIndexes);
+    }
+    if (!status.ok()) {
+      spdlog::error("Failed to read chunk at offset {}: {}", chunkIndex.chunkStartOffset,
+                    status.message);
+      ok = false;
+      break;
+    }
+    const bool sameCompression =
+      block.chunk.compression == compression && options.compressionLevel == 0;
+    // The sizes of a chunk already in the target compression tell if compressing it pays off
+    const bool worthCompressing =
+      compression.empty() ||
+      double(block.chunk.uncompressedSize) >= double(block.chunk.compressedSize) * options.minRatio;
+    block.copy = sameCompression && worthCompressing &&
+                 (!block.messageIndexes.empty() || block.chunk.uncompressedSize == 0);
+    block.store = sameCompression && !worthCompressing;
+
+    results.submit([block = std::move(block), &options]() mutable {
+      return RecompressChunk(std::move(block), options);
+    });
+  }
+  results.finish();
+
+  if (chunkIndexes.empty() && ok) {
+    // Unchunked input: the writer chunks the messages with the target compression
+    for (const auto& view : reader.readMessages()) {
+      if (interrupted()) {
+        break;
+      }
+      status = writer.write(view.message);
+      if (!status.ok()) {
+        spdlog::error("Failed to write message: {}", status.message);
+        ok = false;
+        break;
+      }
+    }
+  }
+
+  // Metadata and attachments are passed through
+  status = CopyMetadataAndAttachments(reader, writer);
+  if (!status.ok()) {
+    spdlog::error("Failed to copy {}", status.message);
+    ok = false;
+  }
+
+  status = writer.close();
+  if (!status.ok()) {
+    spdlog::error("Failed to close output file: {}", status.message);
+    return false;
+  } else if (interrupted()) {
+    spdlog::warn("Interrupted, {} is incomplete", outputFilename);
+    return false;
+  }
+
+  const double seconds =
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  spdlog::info("Recompressed {} chunks ({} stored uncompressed), copied {}", recompressedChunks,
+               storedChunks, copiedChunks);
+  spdlog::info("{} MB -> {} MB of chunks in {:.2f}s ({:.2f} GB/s uncompressed)",
+               inputBytes / (1024 * 1024), outputBytes / (1024 * 1024), seconds,
+               seconds > 0 ? double(uncompressedBytes) / seconds / 1e9 : 0.0);
+  return ok;
+}
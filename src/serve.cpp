@@ -0,0 +1,295 @@
+#include "serve.hpp"
+
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+
+#include "convert.hpp"
+#include "info.hpp"
+#include "split.hpp"
+#include "threadpool.hpp"
+
+// A client must send its request line within this time and size, so it cannot hold a job slot
+// without submitting a job
+constexpr int RequestTimeoutSeconds = 10;
+constexpr size_t MaxRequestLength = 64 * 1024;
+
+static uint64_t ThreadCpuTimeNs() {
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + uint64_t(ts.tv_nsec);
+}
+
+// Total size of a file, or of all files below a directory
+static uint64_t PathSize(const std::string& path) {
+  std::error_code ec;
+  if (std::filesystem::is_regular_file(path, ec)) {
+    return std::filesystem::file_size(path, ec);
+  }
+  uint64_t size = 0;
+  for (const auto& entry : std::filesystem::recursive_directory_iterator(path, ec)) {
+    if (entry.is_regular_file(ec)) {
+      size += entry.file_size(ec);
+    }
+  }
+  return size;
+}
+
+static bool ParseSocketAddress(const std::string& socketPath, sockaddr_un& addr) {
+  addr = {};
+  addr.sun_family = AF_UNIX;
+  if (socketPath.empty() || socketPath.size() >= sizeof(addr.sun_path)) {
+    spdlog::error("Invalid socket path \"{}\"", socketPath);
+    return false;
+  }
+  std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+  return true;
+}
+
+static bool WriteAll(int fd, const std::string& data) {
+  size_t offset = 0;
+  while (offset < data.size()) {
+    const ssize_t n = write(fd, data.data() + offset, data.size() - offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return false;
+    }
+    offset += size_t(n);
+  }
+  return true;
+}
+
+// Read until a newline or EOF. Fails with EMSGSIZE if the line is longer than `maxLength`
+static bool ReadLine(int fd, std::string& line, size_t maxLength = std::string::npos) {
+  char buffer[4096];
+  while (true) {
+    const ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0) {
+      return false;
+    } else if (n == 0) {
+      return true;
+    }
+    line.append(buffer, size_t(n));
+    const auto newline = line.find('\n');
+    if (newline != std::string::npos) {
+      line.resize(newline);
+      return true;
+    } else if (line.size() > maxLength) {
+      errno = EMSGSIZE;
+      return false;
+    }
+  }
+}
+
+static nlohmann::json RunJob(const nlohmann::json& request) {
+  nlohmann::json response;
+  const std::string command = request.value("command", "");
+  const std::string input = request.value("input", "");
+  const std::string output = request.value("output", "");
+  if (input.empty() || (command != "info" && output.empty())) {
+    response["ok"] = false;
+    response["error"] = "missing \"input\" or \"output\"";
+    return response;
+  }
+
+  const auto startTime = std::chrono::steady_clock::now();
+  const uint64_t startCpuTime = ThreadCpuTimeNs();
+
+  bool ok = false;
+  if (command == "split") {
+    SplitOptions options;
+    options.fresh = request.value("fresh", false);
+    ok = Split(input, output, options);
+  } else if (command == "convert") {
+    ConvertOptions options;
+    options.maxChunkDuration = request.value("maxChunkDuration", uint64_t(0)) * 1000000;
+    options.previewFilename = request.value("preview", "");
+    options.keyframesOnly = request.value("keyframesOnly", false);
+    options.maxFps = request.value("maxFps", 0.0);
+    options.fps = request.value("fps", 30.0);
+    options.parallel = request.value("parallel", false);
+    options.threads = request.value("threads", size_t(0));
+    ok = Convert(input, output, options);
+  } else if (command == "info") {
+    auto info = Info(input);
+    ok = info.has_value();
+    if (ok) {
+      response["result"] = std::move(*info);
+    }
+  } else {
+    response["ok"] = false;
+    response["error"] = "unknown command \"" + command + "\"";
+    return response;
+  }
+
+  const auto wallTime = std::chrono::steady_clock::now() - startTime;
+  response["ok"] = ok;
+  if (!ok) {
+    response["error"] = command + " failed, see server log";
+  }
+  response["stats"] = {
+    {"wallTimeMs", std::chrono::duration<double, std::milli>(wallTime).count()},
+    {"cpuTimeMs", double(ThreadCpuTimeNs() - startCpuTime) / 1e6},
+    {"inputBytes", PathSize(input)},
+    {"outputBytes", output.empty() ? 0 : PathSize(output)},
+  };
+  return response;
+}
+
+// Jobs are not passed `stopping`, so a job that started runs to completion. Jobs still queued when
+// the server shuts down are rejected instead of started
+static void HandleConnection(int fd, const std::atomic<bool>* stopping) {
+  std::string line;
+  nlohmann::json response;
+  const timeval timeout{RequestTimeoutSeconds, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (!ReadLine(fd, line, MaxRequestLength)) {
+    spdlog::warn("Failed to read job request: {}", std::strerror(errno));
+    close(fd);
+    return;
+  }
+
+  try {
+    const auto request = nlohmann::json::parse(line);
+    if (stopping && stopping->load()) {
+      spdlog::info("Rejecting job, shutting down: {}", request.dump());
+      response = {{"ok", false}, {"error", "server is shutting down"}};
+    } else {
+      spdlog::info("Job: {}", request.dump());
+      response = RunJob(request);
+    }
+  } catch (const nlohmann::json::exception& err) {
+    response = {{"ok", false}, {"error", err.what()}};
+  } catch (const std::exception& err) {
+    // E.g. std::filesystem errors. The client gets a response either way
+    spdlog::error("Job failed: {}", err.what());
+    response = {{"ok", false}, {"error", err.what()}};
+  } catch (...) {
+    spdlog::error("Job failed with an unknown exception");
+    response = {{"ok", false}, {"error", "unknown exception"}};
+  }
+
+  // Error messages may quote paths that are not valid UTF-8
+  const auto dumped = response.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+  if (!WriteAll(fd, dumped + "\n")) {
+    spdlog::warn("Failed to write job response: {}", std::strerror(errno));
+  }
+  close(fd);
+}
+
+bool Serve(const ServeOptions& options) {
+  sockaddr_un addr;
+  if (!ParseSocketAddress(options.socketPath, addr)) {
+    return false;
+  }
+
+  const int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listenFd < 0) {
+    spdlog::error("socket() failed: {}", std::strerror(errno));
+    return false;
+  }
+
+  // Remove a stale socket left behind by a previous server, but never another kind of file that
+  // the path names by mistake
+  struct stat st {};
+  if (lstat(options.socketPath.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      spdlog::error("\"{}\" exists and is not a socket", options.socketPath);
+      close(listenFd);
+      return false;
+    }
+    unlink(options.socketPath.c_str());
+  } else if (errno != ENOENT) {
+    spdlog::error("Failed to stat \"{}\": {}", options.socketPath, std::strerror(errno));
+    close(listenFd);
+    return false;
+  }
+
+  // Jobs read and write files with the privileges of the server, so only its owner may connect.
+  // Connections are refused until listen(), so restricting the mode between bind() and listen()
+  // leaves no window
+  if (bind(listenFd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      chmod(options.socketPath.c_str(), S_IRUSR | S_IWUSR) != 0 ||
+      listen(listenFd, SOMAXCONN) != 0) {
+    spdlog::error("Failed to listen on \"{}\": {}", options.socketPath, std::strerror(errno));
+    close(listenFd);
+    return false;
+  }
+
+  // Jobs beyond the concurrency limit wait in the pool queue. Schemas built by ProtobufFdSet and
+  // the loaded FFmpeg and protobuf libraries stay resident across jobs
+  ThreadPool pool{options.jobs};
+  spdlog::info("Listening on \"{}\" with {} job slots", options.socketPath, pool.size());
+
+  while (!(options.interrupt && options.interrupt->load())) {
+    pollfd pfd{listenFd, POLLIN, 0};
+    const int ready = poll(&pfd, 1, 250);
+    if (ready < 0 && errno != EINTR) {
+      spdlog::error("poll() failed: {}", std::strerror(errno));
+      break;
+    } else if (ready <= 0) {
+      continue;
+    }
+
+    const int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EINTR && errno != EAGAIN) {
+        spdlog::warn("accept() failed: {}", std::strerror(errno));
+      }
+      continue;
+    }
+    pool.submit([fd, stopping = options.interrupt]() {
+      HandleConnection(fd, stopping);
+    });
+  }
+
+  spdlog::info("Shutting down, rejecting queued jobs and waiting for running jobs");
+  close(listenFd);
+  unlink(options.socketPath.c_str());
+  return true;
+}
+
+bool Submit(const std::string& socketPath, const std::string& request) {
+  sockaddr_un addr;
+  if (!ParseSocketAddress(socketPath, addr)) {
+    return false;
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+    spdlog::error("Failed to connect to \"{}\": {}", socketPath, std::strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+
+  std::string line = request;
+  line.erase(std::remove(line.begin(), line.end(), '\n'), line.end());
+  std::string response;
+  const bool ok = WriteAll(fd, line + "\n") && ReadLine(fd, response);
+  close(fd);
+  if (!ok || response.empty()) {
+    spdlog::error("No response from \"{}\"", socketPath);
+    return false;
+  }
+
+  std::cout << response << "\n";
+  const auto parsed = nlohmann::json::parse(response, nullptr, false);
+  return !parsed.is_discarded() && parsed.value("ok", false);
+}
@@ -0,0 +1,485 @@
+#include "sort.hpp"
+
+#include <mcap/mcap.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+#include "chunk.hpp"
+#include "writer.hpp"
+
+// Runs merged at once. Each open run holds a file descriptor and a read buffer of one record, so
+// more runs than this are merged in several passes
+constexpr size_t MaxMergeFanIn = 128;
+
+using MessageSink = std::function<bool(const mcap::Message&)>;
+
+// An mcap::IWritable appending to a run file
+class RunFileWriter final : public mcap::IWritable {
+public:
+  explicit RunFileWriter(std::FILE* file)
+      : file_(file) {}
+
+  void handleWrite(const std::byte* data, uint64_t size) override {
+    if (std::fwrite(data, 1, size, file_) != size) {
+      failed_ = true;
+    }
+    size_ += size;
+  }
+
+  void end() override {}
+
+  uint64_t size() const override {
+    return size_;
+  }
+
+  bool failed() const {
+    return failed_;
+  }
+
+private:
+  std::FILE* file_;
+  uint64_t size_ = 0;
+  bool failed_ = false;
+};
+
+/**
+ * Sorts a stream of messages by log time within a fixed memory budget. Messages are buffered until
+ * the budget is used up, then sorted and written to a run file of Message records. finish() merges
+ * the runs. Messages with equal log times keep the order they were added in.
+ */
+class ExternalSorter {
+public:
+  ExternalSorter(size_t memoryBudget, std::string tempDir)
+      : memoryBudget_(memoryBudget)
+      , tempDir_(std::move(tempDir)) {}
+
+  ~ExternalSorter() {
+    if (!runDir_.empty()) {
+      std::error_code ec;
+      std::filesystem::remove_all(runDir_, ec);
+    }
+  }
+
+  ExternalSorter(const ExternalSorter&) = delete;
+  ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+  /** Hint at how many bytes of messages will be added, to size the buffer */
+  void reserve(uint64_t bytes) {
+    arena_.reserve(size_t(std::min(uint64_t(memoryBudget_), bytes)));
+  }
+
+  bool add(const mcap::Message& message) {
+    const size_t needed = arena_.size() + message.dataSize + (entries_.size() + 1) * sizeof(Entry);
+    if (needed > memoryBudget_ && !entries_.empty() && !spill()) {
+      return false;
+    }
+    entries_.push_back(Entry{message.logTime, message.publishTime, message.sequence,
+                             message.channelId, arena_.size(), message.dataSize});
+    arena_.insert(arena_.end(), message.data, message.data + message.dataSize);
+    return true;
+  }
+
+  /** Pass every message added so far to `sink` in log time order, then reset */
+  bool finish(const MessageSink& sink) {
+    if (runs_.empty()) {
+      sortEntries();
+      for (const auto& entry : entries_) {
+        if (!sink(entryMessage(entry))) {
+          return false;
+        }
+      }
+      entries_.clear();
+      arena_.clear();
+      return true;
+    }
+
+    if (!entries_.empty() && !spill()) {
+      return false;
+    }
+    // Merge consecutive runs (keeping ties in order) until few enough remain for a final merge
+    while (runs_.size() > MaxMergeFanIn) {
+      std::vector<std::string> merged;
+      for (size_t i = 0; i < runs_.size(); i += MaxMergeFanIn) {
+        const std::vector<std::string> group{
+          runs_.begin() + std::ptrdiff_t(i),
+          runs_.begin() + std::ptrdiff_t(std::min(i + MaxMergeFanIn, runs_.size()))};
+        std::FILE* file = nullptr;
+        const std::string filename = newRunFile(&file);
+        if (!file) {
+          return false;
+        }
+        RunFileWriter output{file};
+        const bool ok = mergeRuns(group, [&](const mcap::Message& message) {
+          mcap::McapWriter::write(output, message);
+          return !output.failed();
+        });
+        const bool closed = std::fclose(file) == 0;
+        removeRuns(group);
+        if (!ok || !closed) {
+          spdlog::error("Failed to write sort run {}", filename);
+          return false;
+        }
+        merged.push_back(filename);
+      }
+      runs_ = std::move(merged);
+    }
+
+    const bool ok = mergeRuns(runs_, sink);
+    removeRuns(runs_);
+    runs_.clear();
+    return ok;
+  }
+
+  size_t spilledRuns() const {
+    return spilledRuns_;
+  }
+  uint64_t spilledBytes() const {
+    return spilledBytes_;
+  }
+
+private:
+  struct Entry {
+    mcap::Timestamp logTime;
+    mcap::Timestamp publishTime;
+    uint32_t sequence;
+    mcap::ChannelId channelId;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  void sortEntries() {
+    std::stable_sort(entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b) {
+      return a.logTime < b.logTime;
+    });
+  }
+
+  mcap::Message entryMessage(const Entry& entry) const {
+    mcap::Message message;
+    message.channelId = entry.channelId;
+    message.sequence = entry.sequence;
+    message.logTime = entry.logTime;
+    message.publishTime = entry.publishTime;
+    message.dataSize = entry.size;
+    message.data = arena_.data() + entry.offset;
+    return message;
+  }
+
+  std::string newRunFile(std::FILE** file) {
+    *file = nullptr;
+    if (runDir_.empty()) {
+      const auto base = tempDir_.empty() ? std::filesystem::temp_directory_path().string()
+                                         : tempDir_;
+      std::string dirTemplate = base + "/mcaptool-sort-XXXXXX";
+      if (!mkdtemp(dirTemplate.data())) {
+        spdlog::error("Failed to create a temporary directory in {}", base);
+        return {};
+      }
+      runDir_ = dirTemplate;
+    }
+    const std::string filename = runDir_ + "/run-" + std::to_string(runCounter_++);
+    *file = std::fopen(filename.c_str(), "wb");
+    if (!*file) {
+      spdlog::error("Failed to create sort run {}", filename);
+    }
+    return filename;
+  }
+
+  bool spill() {
+    sortEntries();
+    std::FILE* file = nullptr;
+    const std::string filename = newRunFile(&file);
+    if (!file) {
+      return false;
+    }
+    RunFileWriter output{file};
+    for (const auto& entry : entries_) {
+      mcap::McapWriter::write(output, entryMessage(entry));
+    }
+    const bool ok = !output.failed() && std::fclose(file) == 0;
+    if (!ok) {
+      spdlog::error("Failed to write sort run {}", filename);
+      return false;
+    }
+
+    spilledRuns_++;
+    spilledBytes_ += output.size();
+    runs_.push_back(filename);
+    entries_.clear();
+    arena_.clear();
+    return true;
+  }
+
+  // K-way merge of run files. Ties go to the earlier run, which holds earlier input
+  bool mergeRuns(const std::vector<std::string>& runs, const MessageSink& sink) {
+    struct Cursor {
+      std::unique_ptr<std::FILE, int (*)(std::FILE*)> file{nullptr, std::fclose};
+      std::unique_ptr<mcap::FileReader> reader;
+      std::unique_ptr<mcap::RecordReader> records;
+      mcap::Message message{};
+      bool failed = false;
+
+      // Read the next message, whose data points into the reader buffer until the next call.
+      // Returns false at the end of the run, with `failed` set if the run is truncated or corrupt
+      bool advance() {
+        const auto record = records->next();
+        if (!record) {
+          failed = !records->status().ok();
+          return false;
+        }
+        // Runs hold nothing but message records
+        failed = record->opcode != mcap::OpCode::Message ||
+                 !mcap::McapReader::ParseMessage(*record, &message).ok();
+        return !failed;
+      }
+    };
+
+    std::vector<Cursor> cursors(runs.size());
+    auto later = [&](size_t a, size_t b) {
+      const auto timeA = cursors[a].message.logTime;
+      const auto timeB = cursors[b].message.logTime;
+      return timeA > timeB || (timeA == timeB && a > b);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap{later};
+    auto advance = [&](size_t i) {
+      if (cursors[i].advance()) {
+        heap.push(i);
+      } else if (cursors[i].failed) {
+        spdlog::error("Failed to read sort run {}", runs[i]);
+        return false;
+      }
+      return true;
+    };
+
+    for (size_t i = 0; i < runs.size(); i++) {
+      auto& cursor = cursors[i];
+      cursor.file.reset(std::fopen(runs[i].c_str(), "rb"));
+      if (!cursor.file) {
+        spdlog::error("Failed to open sort run {}", runs[i]);
+        return false;
+      }
+      cursor.reader = std::make_unique<mcap::FileReader>(cursor.file.get());
+      cursor.records = std::make_unique<mcap::RecordReader>(*cursor.reader, 0);
+      if (!advance(i)) {
+        return false;
+      }
+    }
+
+    while (!heap.empty()) {
+      const size_t i = heap.top();
+      heap.pop();
+      if (!sink(cursors[i].message) || !advance(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void removeRuns(const std::vector<std::string>& runs) {
+    for (const auto& run : runs) {
+      std::error_code ec;
+      std::filesystem::remove(run, ec);
+    }
+  }
+
+  size_t memoryBudget_;
+  std::string tempDir_;
+  std::string runDir_;
+  size_t runCounter_ = 0;
+  std::vector<Entry> entries_;
+  std::vector<std::byte> arena_;
+  std::vector<std::string> runs_;
+  size_t spilledRuns_ = 0;
+  uint64_t spilledBytes_ = 0;
+};
+
+// True if the messages of a chunk, in record order, have non-decreasing log times
+static bool ChunkIsSorted(const std::vector<mcap::MessageIndex>& messageIndexes) {
+  std::vector<std::pair<uint64_t, mcap::Timestamp>> records;
+  for (const auto& messageIndex : messageIndexes) {
+    for (const auto& [logTime, offset] : messageIndex.records) {
+      records.emplace_back(offset, logTime);
+    }
+  }
+  std::sort(records.begin(), records.end());
+  for (size_t i = 1; i < records.size(); i++) {
+    if (records[i].second < records[i - 1].second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Sort(const std::string& inputFilename, const std::string& outputFilename,
+          const SortOptions& options) {
+  mcap::McapReader reader;
+  auto status = reader.open(inputFilename);
+  if (!status.ok()) {
+    spdlog::error("Failed to open input file: {}", status.message);
+    return false;
+  }
+  status = reader.readSummary(mcap::ReadSummaryMethod::AllowFallbackScan);
+  if (!status.ok()) {
+    spdlog::error("Failed to read MCAP summary: {}", status.message);
+    return false;
+  }
+
+  // Chunks in time order. Each group of chunks whose time ranges overlap is sorted as a whole
+  auto chunkIndexes = reader.chunkIndexes();
+  std::sort(chunkIndexes.begin(), chunkIndexes.end(), [](const auto& a, const auto& b) {
+    return std::tie(a.messageStartTime, a.chunkStartOffset) <
+           std::tie(b.messageStartTime, b.chunkStartOffset);
+  });
+
+  ChunkedWriterOptions writerOptions;
+  writerOptions.profile = reader.header() ? reader.header()->profile : "";
+  if (!chunkIndexes.empty()) {
+    writerOptions.compression = mcap::McapReader::ParseCompression(chunkIndexes[0].compression)
+                                  .value_or(mcap::Compression::Zstd);
+  }
+  ChunkedWriter writer;
+  status = writer.open(outputFilename, writerOptions);
+  if (!status.ok()) {
+    spdlog::error("Failed to open output file: {}", status.message);
+    return false;
+  }
+  for (const auto& [schemaId, schema] : reader.schemas()) {
+    writer.addSchema(*schema);
+  }
+  for (const auto& [channelId, channel] : reader.channels()) {
+    writer.addChannel(*channel);
+  }
+
+  auto interrupted = [&]() {
+    return options.interrupt && options.interrupt->load();
+  };
+  const MessageSink writeMessage = [&](const mcap::Message& message) {
+    const auto writeStatus = writer.write(message);
+    if (!writeStatus.ok()) {
+      spdlog::error("Failed to write message: {}", writeStatus.message);
+      return false;
+    }
+    return true;
+  };
+
+  ExternalSorter sorter{std::max(options.memoryBudget, size_t(1024 * 1024)), options.tempDir};
+  auto* dataSource = reader.dataSource();
+  size_t copiedChunks = 0;
+  size_t sortedChunks = 0;
+  bool ok = true;
+
+  if (chunkIndexes.empty()) {
+    // Unchunked input: sort all messages in one group
+    for (const auto& view : reader.readMessages()) {
+      if (interrupted() || !(ok = sorter.add(view.message))) {
+        break;
+      }
+    }
+    ok = ok && !interrupted() && sorter.finish(writeMessage);
+  }
+
+  std::vector<mcap::MessageIndex> messageIndexes;
+  std::vector<std::byte> buffer;
+  for (size_t groupStart = 0; groupStart < chunkIndexes.size() && ok;) {
+    if (interrupted()) {
+      break;
+    }
+
+    // Extend the group while the next chunk starts before the group ends
+    size_t groupEnd = groupStart + 1;
+    mcap::Timestamp groupEndTime = chunkIndexes[groupStart].messageEndTime;
+    uint64_t groupBytes = chunkIndexes[groupStart].uncompressedSize;
+    while (groupEnd < chunkIndexes.size() &&
+           chunkIndexes[groupEnd].messageStartTime < groupEndTime) {
+      groupEndTime = std::max(groupEndTime, chunkIndexes[groupEnd].messageEndTime);
+      groupBytes += chunkIndexes[groupEnd].uncompressedSize;
+      groupEnd++;
+    }
+
+    if (groupEnd == groupStart + 1) {
+      const auto& chunkIndex = chunkIndexes[groupStart];
+      status = ReadMessageIndexes(*dataSource, chunkIndex, messageIndexes);
+      const bool indexed = !messageIndexes.empty() || chunkIndex.uncompressedSize == 0;
+      if (status.ok() && indexed && ChunkIsSorted(messageIndexes)) {
+        mcap::Chunk chunk;
+        status = ReadChunk(*dataSource, chunkIndex, &chunk);
+        if (status.ok()) {
+          status = writer.writeChunk(chunk, messageIndexes);
+        }
+        if (!status.ok()) {
+          spdlog::error("Failed to copy chunk at offset {}: {}", chunkIndex.chunkStartOffset,
+                        status.message);
+          ok = false;
+        }
+        copiedChunks++;
+        groupStart = groupEnd;
+        continue;
+      }
+    }
+
+    // Sort the messages of the group, read in file order so that ties keep their input order
+    std::sort(chunkIndexes.begin() + std::ptrdiff_t(groupStart),
+              chunkIndexes.begin() + std::ptrdiff_t(groupEnd), [](const auto& a, const auto& b) {
+                return a.chunkStartOffset < b.chunkStartOffset;
+              });
+    sorter.reserve(groupBytes);
+    for (size_t i = groupStart; i < groupEnd && ok; i++) {
+      const auto& chunkIndex = chunkIndexes[i];
+      mcap::Chunk chunk;
+      const std::byte* records = nullptr;
+      status = ReadChunk(*dataSource, chunkIndex, &chunk);
+      if (status.ok()) {
+        status = DecompressChunk(chunk, buffer, &records);
+      }
+      if (status.ok()) {
+        status = ForEachRecord(records, chunk.uncompressedSize,
+                               [&](const mcap::Record& record, uint64_t) {
+                                 mcap::Message message;
+                                 if (record.opcode != mcap::OpCode::Message ||
+                                     !mcap::McapReader::ParseMessage(record, &message).ok()) {
+                                   return true;
+                                 }
+                                 return ok = sorter.add(message);
+                               });
+      }
+      if (!status.ok()) {
+        spdlog::error("Failed to read chunk at offset {}: {}", chunkIndex.chunkStartOffset,
+                      status.message);
+        ok = false;
+      }
+    }
+    ok = ok && sorter.finish(writeMessage);
+    sortedChunks += groupEnd - groupStart;
+    groupStart = groupEnd;
+  }
+
+  // Metadata and attachments are passed through
+  status = CopyMetadataAndAttachments(reader, writer);
+  if (!status.ok()) {
+    spdlog::error("Failed to copy {}", status.message);
+    ok = false;
+  }
+
+  status = writer.close();
+  if (!status.ok()) {
+    spdlog::error("Failed to close output file: {}", status.message);
+    return false;
+  }
+  if (interrupted()) {
+    spdlog::warn("Interrupted, {} is incomplete", outputFilename);
+    return false;
+  }
+
+  spdlog::info("Copied {} sorted chunks, sorted {} overlapping chunks ({} runs, {} MB spilled)",
+               copiedChunks, sortedChunks, sorter.spilledRuns(),
+               sorter.spilledBytes() / (1024 * 1024));
+  return ok;
+}
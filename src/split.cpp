@@ -1,154 +1,738 @@
 #include "split.hpp"
 
 #include <mcap/mcap.hpp>
+#include <nlohmann/json.hpp>
 
+#include <algorithm>
+#include <array>
 #include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 
+#include "base64.hpp"
+#include "chunk.hpp"
+#include "writer.hpp"
+
+constexpr int CheckpointVersion = 3;
+constexpr const char* CheckpointFilename = ".split-checkpoint.json";
+// Chunk, attachment and metadata indexes of the outputs, one JSON object per line. Each checkpoint
+// appends the indexes written since the previous one, so saving a checkpoint costs time
+// proportional to the new data rather than to everything split so far
+constexpr const char* CheckpointLogFilename = ".split-checkpoint.log";
+// Input bytes processed between checkpoints. A run that is killed before it can finish its outputs
+// redoes at most this much work when it is resumed
+constexpr uint64_t CheckpointInterval = 256 * 1024 * 1024;
+// Input bytes hashed at the start of the input and just before the checkpoint offset to recognize
+// the input file on the next run. The start alone is shared by recordings of the same recorder
+constexpr uint64_t FingerprintLength = 4096;
+
 struct OutputMcap {
   std::string filename;
   mcap::Channel channel;
-  mcap::Schema schema;
-  std::unique_ptr<mcap::McapWriter> writer;
-  size_t messageCount;
+  std::unique_ptr<ChunkedWriter> writer;
+  // Indexes of the writer state that are already in the checkpoint log
+  size_t loggedChunkIndexes = 0;
+  size_t loggedAttachmentIndexes = 0;
+  size_t loggedMetadataIndexes = 0;
+};
 
-  OutputMcap(const std::string& name)
-      : filename(name)
-      , messageCount(0) {}
+// Everything needed to continue a split where the previous run stopped
+struct SplitCheckpoint {
+  std::string inputFilename;
+  // Input size when the checkpoint was saved. An input that has since shrunk was replaced
+  uint64_t inputSize = 0;
+  uint64_t fingerprint = 0;
+  // Input offset just past the last record whose messages are in the outputs
+  uint64_t offset = 0;
+  // Length of the checkpoint log. Entries past it were appended by a run killed before it saved
+  // the checkpoint
+  uint64_t logSize = 0;
+  std::string profile;
+  std::map<mcap::SchemaId, mcap::Schema> schemas;
+  std::map<mcap::ChannelId, mcap::Channel> channels;
+  // Output filename and writer state by channel ID, as loaded from a checkpoint and its log
+  std::map<mcap::ChannelId, std::pair<std::string, ChunkedWriterState>> outputs;
 };
 
-bool Split(const std::string& inputFilename, const std::string& outputDir) {
-  // Open the input file
-  mcap::McapReader reader;
-  auto status = reader.open(inputFilename);
-  if (!status.ok()) {
-    std::cerr << "Failed to open input file: " << status.message << "\n";
+// FNV-1a hash of the first FingerprintLength bytes of `input` and of the FingerprintLength bytes
+// before `offset`
+static uint64_t Fingerprint(mcap::IReadable& input, uint64_t offset) {
+  const uint64_t length = std::min(FingerprintLength, offset);
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (const uint64_t start : {uint64_t(0), offset - length}) {
+    std::byte* data = nullptr;
+    const uint64_t size = input.read(&data, start, length);
+    for (uint64_t i = 0; i < size; i++) {
+      hash = (hash ^ uint64_t(data[i])) * 0x100000001b3ull;
+    }
+  }
+  return hash;
+}
+
+static nlohmann::json ToJson(const mcap::Schema& schema) {
+  return {{"id", schema.id},
+          {"name", schema.name},
+          {"encoding", schema.encoding},
+          {"data", BytesToBase64(schema.data)}};
+}
+
+static nlohmann::json ToJson(const mcap::Channel& channel) {
+  return {{"id", channel.id},
+          {"topic", channel.topic},
+          {"messageEncoding", channel.messageEncoding},
+          {"schemaId", channel.schemaId},
+          {"metadata", channel.metadata}};
+}
+
+static nlohmann::json ToJson(const mcap::ChunkIndex& index) {
+  return {{"messageStartTime", index.messageStartTime},
+          {"messageEndTime", index.messageEndTime},
+          {"chunkStartOffset", index.chunkStartOffset},
+          {"chunkLength", index.chunkLength},
+          {"messageIndexOffsets", index.messageIndexOffsets},
+          {"messageIndexLength", index.messageIndexLength},
+          {"compression", index.compression},
+          {"compressedSize", index.compressedSize},
+          {"uncompressedSize", index.uncompressedSize}};
+}
+
+static nlohmann::json ToJson(const mcap::AttachmentIndex& index) {
+  return {{"offset", index.offset},
+          {"length", index.length},
+          {"logTime", index.logTime},
+          {"createTime", index.createTime},
+          {"dataSize", index.dataSize},
+          {"name", index.name},
+          {"mediaType", index.mediaType}};
+}
+
+static nlohmann::json ToJson(const mcap::MetadataIndex& index) {
+  return {{"offset", index.offset}, {"length", index.length}, {"name", index.name}};
+}
+
+// The writer state except for its indexes, which are kept in the checkpoint log
+static nlohmann::json ToJson(const ChunkedWriterState& state) {
+  nlohmann::json json;
+  json["dataEnd"] = state.dataEnd;
+  for (const auto& [schemaId, schema] : state.schemas) {
+    json["schemaIds"].push_back(schemaId);
+  }
+  for (const auto& [channelId, channel] : state.channels) {
+    json["channelIds"].push_back(channelId);
+  }
+  json["chunkIndexCount"] = state.chunkIndexes.size();
+  json["attachmentIndexCount"] = state.attachmentIndexes.size();
+  json["metadataIndexCount"] = state.metadataIndexes.size();
+  const auto& stats = state.statistics;
+  json["statistics"] = {
+    {"messageCount", stats.messageCount},
+    {"schemaCount", stats.schemaCount},
+    {"channelCount", stats.channelCount},
+    {"attachmentCount", stats.attachmentCount},
+    {"metadataCount", stats.metadataCount},
+    {"chunkCount", stats.chunkCount},
+    {"messageStartTime", stats.messageStartTime},
+    {"messageEndTime", stats.messageEndTime},
+    {"channelMessageCounts", stats.channelMessageCounts},
+  };
+  return json;
+}
+
+static nlohmann::json ToJson(const SplitCheckpoint& checkpoint,
+                             const std::unordered_map<mcap::ChannelId, OutputMcap>& outputs) {
+  nlohmann::json json;
+  json["version"] = CheckpointVersion;
+  json["input"] = checkpoint.inputFilename;
+  json["inputSize"] = checkpoint.inputSize;
+  json["fingerprint"] = checkpoint.fingerprint;
+  json["offset"] = checkpoint.offset;
+  json["logSize"] = checkpoint.logSize;
+  json["profile"] = checkpoint.profile;
+  json["schemas"] = nlohmann::json::array();
+  for (const auto& [schemaId, schema] : checkpoint.schemas) {
+    json["schemas"].push_back(ToJson(schema));
+  }
+  json["channels"] = nlohmann::json::array();
+  for (const auto& [channelId, channel] : checkpoint.channels) {
+    json["channels"].push_back(ToJson(channel));
+  }
+  json["outputs"] = nlohmann::json::array();
+  for (const auto& [channelId, output] : outputs) {
+    json["outputs"].push_back({{"channelId", channelId},
+                               {"filename", output.filename},
+                               {"state", ToJson(output.writer->state())}});
+  }
+  return json;
+}
+
+// Append the indexes `output` wrote since the last checkpoint to `entries` as checkpoint log lines
+static void AppendLogEntries(mcap::ChannelId channelId, OutputMcap& output, std::string& entries) {
+  const auto& state = output.writer->state();
+  auto append = [&](const char* key, const nlohmann::json& index) {
+    entries += nlohmann::json{{"channelId", channelId}, {key, index}}.dump();
+    entries += "\n";
+  };
+  for (; output.loggedChunkIndexes < state.chunkIndexes.size(); output.loggedChunkIndexes++) {
+    append("chunkIndex", ToJson(state.chunkIndexes[output.loggedChunkIndexes]));
+  }
+  for (; output.loggedAttachmentIndexes < state.attachmentIndexes.size();
+       output.loggedAttachmentIndexes++) {
+    append("attachmentIndex", ToJson(state.attachmentIndexes[output.loggedAttachmentIndexes]));
+  }
+  for (; output.loggedMetadataIndexes < state.metadataIndexes.size();
+       output.loggedMetadataIndexes++) {
+    append("metadataIndex", ToJson(state.metadataIndexes[output.loggedMetadataIndexes]));
+  }
+}
+
+// Parse a checkpoint written by ToJson() and the first `logSize` bytes of its log. Throws
+// nlohmann::json::exception or std::runtime_error
+static SplitCheckpoint ParseCheckpoint(const nlohmann::json& json, std::istream& log) {
+  if (json.at("version").get<int>() != CheckpointVersion) {
+    throw std::runtime_error("unsupported checkpoint version");
+  }
+
+  SplitCheckpoint checkpoint;
+  checkpoint.inputFilename = json.at("input").get<std::string>();
+  checkpoint.inputSize = json.at("inputSize").get<uint64_t>();
+  checkpoint.fingerprint = json.at("fingerprint").get<uint64_t>();
+  checkpoint.offset = json.at("offset").get<uint64_t>();
+  checkpoint.logSize = json.at("logSize").get<uint64_t>();
+  checkpoint.profile = json.at("profile").get<std::string>();
+
+  for (const auto& item : json.at("schemas")) {
+    mcap::Schema schema;
+    schema.id = item.at("id").get<mcap::SchemaId>();
+    schema.name = item.at("name").get<std::string>();
+    schema.encoding = item.at("encoding").get<std::string>();
+    auto data = Base64ToBytes(item.at("data").get<std::string>());
+    if (!data) {
+      throw std::runtime_error("invalid schema data");
+    }
+    schema.data = std::move(*data);
+    checkpoint.schemas.emplace(schema.id, std::move(schema));
+  }
+  for (const auto& item : json.at("channels")) {
+    mcap::Channel channel;
+    channel.id = item.at("id").get<mcap::ChannelId>();
+    channel.topic = item.at("topic").get<std::string>();
+    channel.messageEncoding = item.at("messageEncoding").get<std::string>();
+    channel.schemaId = item.at("schemaId").get<mcap::SchemaId>();
+    channel.metadata = item.at("metadata").get<mcap::KeyValueMap>();
+    checkpoint.channels.emplace(channel.id, std::move(channel));
+  }
+
+  // Chunk, attachment and metadata index counts by channel ID, checked against the log
+  std::map<mcap::ChannelId, std::array<size_t, 3>> indexCounts;
+  for (const auto& item : json.at("outputs")) {
+    const auto& stateJson = item.at("state");
+    ChunkedWriterState state;
+    state.dataEnd = stateJson.at("dataEnd").get<uint64_t>();
+    for (const auto& schemaId : stateJson.value("schemaIds", nlohmann::json::array())) {
+      state.schemas.emplace(schemaId.get<mcap::SchemaId>(),
+                            checkpoint.schemas.at(schemaId.get<mcap::SchemaId>()));
+    }
+    for (const auto& channelId : stateJson.value("channelIds", nlohmann::json::array())) {
+      state.channels.emplace(channelId.get<mcap::ChannelId>(),
+                             checkpoint.channels.at(channelId.get<mcap::ChannelId>()));
+    }
+    const auto& statsJson = stateJson.at("statistics");
+    auto& stats = state.statistics;
+    stats.messageCount = statsJson.at("messageCount").get<uint64_t>();
+    stats.schemaCount = statsJson.at("schemaCount").get<uint16_t>();
+    stats.channelCount = statsJson.at("channelCount").get<uint32_t>();
+    stats.attachmentCount = statsJson.at("attachmentCount").get<uint32_t>();
+    stats.metadataCount = statsJson.at("metadataCount").get<uint32_t>();
+    stats.chunkCount = statsJson.at("chunkCount").get<uint32_t>();
+    stats.messageStartTime = statsJson.at("messageStartTime").get<mcap::Timestamp>();
+    stats.messageEndTime = statsJson.at("messageEndTime").get<mcap::Timestamp>();
+    stats.channelMessageCounts = statsJson.at("channelMessageCounts")
+                                   .get<std::unordered_map<mcap::ChannelId, uint64_t>>();
+
+    const auto channelId = item.at("channelId").get<mcap::ChannelId>();
+    indexCounts[channelId] = {stateJson.at("chunkIndexCount").get<size_t>(),
+                              stateJson.at("attachmentIndexCount").get<size_t>(),
+                              stateJson.at("metadataIndexCount").get<size_t>()};
+    checkpoint.outputs.emplace(
+      channelId, std::make_pair(item.at("filename").get<std::string>(), std::move(state)));
+  }
+
+  uint64_t logOffset = 0;
+  std::string line;
+  while (logOffset < checkpoint.logSize && std::getline(log, line)) {
+    logOffset += line.size() + 1;
+    const auto entry = nlohmann::json::parse(line);
+    const auto outputIt = checkpoint.outputs.find(entry.at("channelId").get<mcap::ChannelId>());
+    if (outputIt == checkpoint.outputs.end()) {
+      throw std::runtime_error("log entry for an unknown output");
+    }
+    auto& state = outputIt->second.second;
+    if (entry.contains("chunkIndex")) {
+      const auto& indexJson = entry.at("chunkIndex");
+      mcap::ChunkIndex index;
+      index.messageStartTime = indexJson.at("messageStartTime").get<mcap::Timestamp>();
+      index.messageEndTime = indexJson.at("messageEndTime").get<mcap::Timestamp>();
+      index.chunkStartOffset = indexJson.at("chunkStartOffset").get<mcap::ByteOffset>();
+      index.chunkLength = indexJson.at("chunkLength").get<mcap::ByteOffset>();
+      index.messageIndexOffsets = indexJson.at("messageIndexOffsets")
+                                    .get<std::unordered_map<mcap::ChannelId, mcap::ByteOffset>>();
+      index.messageIndexLength = indexJson.at("messageIndexLength").get<mcap::ByteOffset>();
+      index.compression = indexJson.at("compression").get<std::string>();
+      index.compressedSize = indexJson.at("compressedSize").get<mcap::ByteOffset>();
+      index.uncompressedSize = indexJson.at("uncompressedSize").get<mcap::ByteOffset>();
+      state.chunkIndexes.push_back(std::move(index));
+    } else if (entry.contains("attachmentIndex")) {
+      const auto& indexJson = entry.at("attachmentIndex");
+      mcap::AttachmentIndex index;
+      index.offset = indexJson.at("offset").get<mcap::ByteOffset>();
+      index.length = indexJson.at("length").get<mcap::ByteOffset>();
+      index.logTime = indexJson.at("logTime").get<mcap::Timestamp>();
+      index.createTime = indexJson.at("createTime").get<mcap::Timestamp>();
+      index.dataSize = indexJson.at("dataSize").get<uint64_t>();
+      index.name = indexJson.at("name").get<std::string>();
+      index.mediaType = indexJson.at("mediaType").get<std::string>();
+      state.attachmentIndexes.push_back(std::move(index));
+    } else {
+      const auto& indexJson = entry.at("metadataIndex");
+      mcap::MetadataIndex index;
+      index.offset = indexJson.at("offset").get<uint64_t>();
+      index.length = indexJson.at("length").get<uint64_t>();
+      index.name = indexJson.at("name").get<std::string>();
+      state.metadataIndexes.push_back(std::move(index));
+    }
+  }
+  if (logOffset != checkpoint.logSize) {
+    throw std::runtime_error("checkpoint log is shorter than recorded");
+  }
+
+  // Every index must be in the log exactly once
+  for (const auto& [channelId, output] : checkpoint.outputs) {
+    const auto& state = output.second;
+    const std::array<size_t, 3> counts{state.chunkIndexes.size(), state.attachmentIndexes.size(),
+                                       state.metadataIndexes.size()};
+    if (counts != indexCounts[channelId]) {
+      throw std::runtime_error("checkpoint log does not match the checkpoint");
+    }
+  }
+  return checkpoint;
+}
+
+static std::optional<SplitCheckpoint> LoadCheckpoint(const std::string& filename,
+                                                     const std::string& logFilename) {
+  std::ifstream file{filename};
+  std::ifstream log{logFilename, std::ios::binary};
+  if (!file) {
+    return {};
+  }
+  const auto json = nlohmann::json::parse(file, nullptr, false);
+  if (json.is_discarded()) {
+    std::cerr << "Ignoring unreadable checkpoint \"" << filename << "\"\n";
+    return {};
+  }
+  try {
+    return ParseCheckpoint(json, log);
+  } catch (const std::exception& err) {
+    std::cerr << "Ignoring invalid checkpoint \"" << filename << "\": " << err.what() << "\n";
+    return {};
+  }
+}
+
+// Append `entries` to the checkpoint log. They only take effect once a checkpoint recording the
+// new log size is saved
+static bool AppendCheckpointLog(const std::string& filename, const std::string& entries) {
+  std::ofstream file{filename, std::ios::app | std::ios::binary};
+  file << entries;
+  file.close();
+  if (!file) {
+    std::cerr << "Failed to write checkpoint log \"" << filename << "\"\n";
     return false;
   }
+  return true;
+}
 
-  const auto& profile = reader.header()->profile;
+// Write the checkpoint to a temporary file and rename it into place, so a run killed while
+// writing the checkpoint leaves the previous one intact
+static bool SaveCheckpoint(const std::string& filename, const nlohmann::json& checkpoint) {
+  const std::string tempFilename = filename + ".tmp";
+  {
+    std::ofstream file{tempFilename, std::ios::trunc};
+    file << checkpoint.dump() << "\n";
+    file.close();
+    if (!file) {
+      std::cerr << "Failed to write checkpoint \"" << tempFilename << "\"\n";
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tempFilename, filename, ec);
+  if (ec) {
+    std::cerr << "Failed to write checkpoint \"" << filename << "\": " << ec.message() << "\n";
+    return false;
+  }
+  return true;
+}
+
+std::string TopicFilename(const std::string& topic) {
+  std::string filename = topic;
+  while (!filename.empty() && filename[0] == '/') {
+    filename = filename.substr(1);
+  }
+  if (filename.empty()) {
+    std::cerr << "Failed to sanitize topic name for use as a filename: \"" << topic << "\"\n";
+  }
+  if (filename == "index") {
+    filename = "index_";
+  }
+  std::replace_if(
+    filename.begin(), filename.end(),
+    [](char c) {
+      return !std::isalnum(c);
+    },
+    '_');
+  return filename;
+}
+
+static ChunkedWriterOptions OutputWriterOptions(const std::string& profile,
+                                                const mcap::Schema* schema) {
+  ChunkedWriterOptions writerOpts;
+  writerOpts.profile = profile;
+
+  // Check if the schemaName contains the word "compressed" (case-insensitive)
+  // and disable compression if so
+  const char* compressed = "compressed";
+  if (schema && std::search(schema->name.begin(), schema->name.end(), compressed,
+                            compressed + 10, [](char a, char b) {
+                              return std::tolower(a) == std::tolower(b);
+                            }) != schema->name.end()) {
+    writerOpts.compression = mcap::Compression::None;
+  }
+  return writerOpts;
+}
+
+bool Split(const std::string& inputFilename, const std::string& outputDir,
+           const SplitOptions& options) {
+  // Open the input file. It is read record by record rather than through its summary, so a
+  // recording that is still being written can be split up to its last complete record
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> inputFile{
+    std::fopen(inputFilename.c_str(), "rb"), std::fclose};
+  if (!inputFile) {
+    std::cerr << "Failed to open input file: " << std::strerror(errno) << "\n";
+    return false;
+  }
+  mcap::FileReader input{inputFile.get()};
 
   // Create the output directory (mkdir -p) if it doesn't exist
-  if (!std::filesystem::exists(outputDir)) {
-    if (!std::filesystem::create_directories(outputDir)) {
+  std::error_code ec;
+  if (!std::filesystem::exists(outputDir, ec)) {
+    if (!std::filesystem::create_directories(outputDir, ec)) {
       std::cerr << "Failed to create output directory: " << outputDir << "\n";
       return false;
     }
   }
 
-  // Get the list of all channels in the input file
-  status = reader.readSummary(mcap::ReadSummaryMethod::AllowFallbackScan);
-  if (!status.ok()) {
-    std::cerr << "Failed to read MCAP summary: " << status.message << "\n";
-    return false;
+  const std::string inputPath = std::filesystem::absolute(inputFilename, ec).lexically_normal();
+  const std::string checkpointFilename = outputDir + "/" + CheckpointFilename;
+  const std::string checkpointLogFilename = outputDir + "/" + CheckpointLogFilename;
+
+  // Pick up where the previous run stopped if it split the same input into this directory. Bytes
+  // before the checkpoint offset are assumed to be unchanged, which holds for recordings that
+  // are only ever appended to. An input that was rotated or replaced at the same path is caught by
+  // its size or by the fingerprint of its start and of the bytes before the checkpoint offset
+  std::optional<SplitCheckpoint> previous;
+  if (!options.fresh) {
+    previous = LoadCheckpoint(checkpointFilename, checkpointLogFilename);
   }
-  if (!reader.statistics().has_value()) {
-    std::cerr << "Failed to retrieve MCAP statistics after summary parsing\n";
-    return false;
+  if (previous && (previous->inputFilename != inputPath || input.size() < previous->offset ||
+                   input.size() < previous->inputSize ||
+                   Fingerprint(input, previous->offset) != previous->fingerprint)) {
+    std::cerr << "Checkpoint in " << outputDir << " is for a different input, splitting from the "
+              << "start\n";
+    previous.reset();
+  }
+
+  SplitCheckpoint checkpoint;
+  std::unordered_map<mcap::ChannelId, OutputMcap> outputMcaps;
+  std::unordered_set<std::string> outputFilenames;
+
+  if (previous) {
+    checkpoint = std::move(*previous);
+    for (const auto& [channelId, output] : checkpoint.outputs) {
+      const auto& [filename, state] = output;
+      const auto channelIt = checkpoint.channels.find(channelId);
+      if (channelIt == checkpoint.channels.end()) {
+        previous.reset();
+        break;
+      }
+      const auto schemaIt = checkpoint.schemas.find(channelIt->second.schemaId);
+      const mcap::Schema* schema = schemaIt != checkpoint.schemas.end() ? &schemaIt->second
+                                                                        : nullptr;
+
+      OutputMcap outputMcap{filename, channelIt->second, std::make_unique<ChunkedWriter>(),
+                            state.chunkIndexes.size(), state.attachmentIndexes.size(),
+                            state.metadataIndexes.size()};
+      const auto status = outputMcap.writer->resume(
+        filename, OutputWriterOptions(checkpoint.profile, schema), state);
+      if (!status.ok()) {
+        std::cerr << "Failed to resume output file: " << status.message << "\n";
+        previous.reset();
+        break;
+      }
+      outputFilenames.emplace(std::filesystem::path(filename).stem().string());
+      outputMcaps.emplace(channelId, std::move(outputMcap));
+    }
+    // Drop log entries appended by a run that was killed before it saved its checkpoint
+    if (previous) {
+      std::filesystem::resize_file(checkpointLogFilename, checkpoint.logSize, ec);
+      if (ec) {
+        std::cerr << "Failed to truncate checkpoint log: " << ec.message() << "\n";
+        return false;
+      }
+    }
+    // The writers hold the output states from here on
+    checkpoint.outputs.clear();
+    if (previous) {
+      std::cerr << "Resuming split of " << inputFilename << " at offset " << checkpoint.offset
+                << "\n";
+    } else {
+      std::cerr << "Checkpoint in " << outputDir << " does not match its output files, splitting "
+                << "from the start\n";
+      outputMcaps.clear();
+      outputFilenames.clear();
+    }
   }
-  const auto& stats = *reader.statistics();
 
-  // FIXME: Support channels with schemaId=0
+  if (!previous) {
+    checkpoint = SplitCheckpoint{};
+    checkpoint.inputFilename = inputPath;
+
+    std::byte* magic = nullptr;
+    if (input.read(&magic, 0, sizeof(mcap::Magic)) != sizeof(mcap::Magic) ||
+        std::memcmp(magic, mcap::Magic, sizeof(mcap::Magic)) != 0) {
+      std::cerr << "Failed to open input file: not a MCAP file\n";
+      return false;
+    }
+    mcap::RecordReader headerReader{input, sizeof(mcap::Magic)};
+    const auto record = headerReader.next();
+    mcap::Header header;
+    if (!record || record->opcode != mcap::OpCode::Header ||
+        !mcap::McapReader::ParseHeader(*record, &header).ok()) {
+      std::cerr << "Failed to read MCAP header\n";
+      return false;
+    }
+    checkpoint.profile = header.profile;
+    checkpoint.offset = headerReader.curRecordOffset() + record->recordSize();
+
+    std::ofstream log{checkpointLogFilename, std::ios::trunc | std::ios::binary};
+    if (!log) {
+      std::cerr << "Failed to create checkpoint log \"" << checkpointLogFilename << "\"\n";
+      return false;
+    }
+  }
 
   // FIXME: Support multiple channels publishing to the same topic as long as
   // they all share the same message encoding and schemaId
-  std::unordered_map<mcap::ChannelId, OutputMcap> outputMcaps;
-  std::unordered_set<std::string> outputFilenames;
 
-  // Create a map of output MCAP files, one per channel
-  for (const auto& [channelId, channelPtr] : reader.channels()) {
-    const auto& channel = *channelPtr;
-    const auto& schema = *reader.schema(channel.schemaId);
-
-    // Sanitize the topic name for use as a filename. Strip any leading '/' and
-    // replace all non-alphanumeric characters with underscores
-    std::string filename = channel.topic;
-    while (!filename.empty() && filename[0] == '/') {
-      filename = filename.substr(1);
-    }
-    if (filename.empty()) {
-      std::cerr << "Failed to sanitize topic name for use as a filename: \"" << channel.topic
-                << "\"\n";
-    }
-    if (filename == "index") {
-      filename = "index_";
-    }
-    std::replace_if(
-      filename.begin(), filename.end(),
-      [](char c) {
-        return !std::isalnum(c);
-      },
-      '_');
+  // Create an output MCAP file the first time each channel is seen
+  auto addOutput = [&](const mcap::Channel& channel) {
+    if (outputMcaps.count(channel.id) > 0) {
+      return true;
+    }
+
+    const std::string filename = TopicFilename(channel.topic);
     if (outputFilenames.count(filename) > 0) {
       std::cerr << "Failed to create output file: duplicate filename \"" << filename << "\"\n";
       return false;
     }
-    outputFilenames.emplace(filename);
-
-    // Create the output file
-    const auto outputFilename = outputDir + "/" + filename + ".mcap";
-    OutputMcap outputMcap{outputFilename};
-    outputMcap.channel = channel;
-    outputMcap.schema = schema;
-
-    mcap::McapWriterOptions writerOpts{profile};
 
-    // Check if the schemaName contains the word "compressed" (case-insensitive)
-    // and disable compression if so
-    const char* compressed = "compressed";
-    if (std::search(schema.name.begin(), schema.name.end(), compressed, compressed + 10,
-                    [](char a, char b) {
-                      return std::tolower(a) == std::tolower(b);
-                    }) != schema.name.end()) {
-      writerOpts.compression = mcap::Compression::None;
+    const mcap::Schema* schema = nullptr;
+    if (channel.schemaId != 0) {
+      const auto it = checkpoint.schemas.find(channel.schemaId);
+      if (it == checkpoint.schemas.end()) {
+        std::cerr << "Channel \"" << channel.topic << "\" references unknown schema "
+                  << channel.schemaId << "\n";
+        return false;
+      }
+      schema = &it->second;
     }
 
-    // Open this output file
-    outputMcap.writer = std::make_unique<mcap::McapWriter>();
-    status = outputMcap.writer->open(outputFilename, writerOpts);
+    OutputMcap outputMcap{outputDir + "/" + filename + ".mcap", channel,
+                          std::make_unique<ChunkedWriter>()};
+    const auto status = outputMcap.writer->open(outputMcap.filename,
+                                                OutputWriterOptions(checkpoint.profile, schema));
     if (!status.ok()) {
       std::cerr << "Failed to open output file: " << status.message << "\n";
       return false;
     }
+    if (schema) {
+      outputMcap.writer->addSchema(*schema);
+    }
+    outputMcap.writer->addChannel(channel);
 
-    // schema.id is overwritten by McapWriter::addSchema()
-    outputMcap.writer->addSchema(outputMcap.schema);
-    outputMcap.channel.schemaId = outputMcap.schema.id;
+    outputFilenames.emplace(filename);
+    outputMcaps.emplace(channel.id, std::move(outputMcap));
+    return true;
+  };
 
-    // channel.id is overwritten by McapWriter::addChannel()
-    outputMcap.writer->addChannel(outputMcap.channel);
-    outputMcaps.emplace(channelId, std::move(outputMcap));
-  }
+  auto handleRecord = [&](const mcap::Record& record) {
+    switch (record.opcode) {
+      case mcap::OpCode::Schema: {
+        mcap::Schema schema;
+        const auto status = mcap::McapReader::ParseSchema(record, &schema);
+        if (!status.ok()) {
+          std::cerr << "Failed to parse schema: " << status.message << "\n";
+          return false;
+        }
+        checkpoint.schemas.emplace(schema.id, std::move(schema));
+        return true;
+      }
+      case mcap::OpCode::Channel: {
+        mcap::Channel channel;
+        const auto status = mcap::McapReader::ParseChannel(record, &channel);
+        if (!status.ok()) {
+          std::cerr << "Failed to parse channel: " << status.message << "\n";
+          return false;
+        }
+        checkpoint.channels.emplace(channel.id, channel);
+        return addOutput(channel);
+      }
+      case mcap::OpCode::Message: {
+        mcap::Message message;
+        auto status = mcap::McapReader::ParseMessage(record, &message);
+        if (!status.ok()) {
+          std::cerr << "Failed to parse message: " << status.message << "\n";
+          return false;
+        }
+        const auto it = outputMcaps.find(message.channelId);
+        if (it == outputMcaps.end()) {
+          std::cerr << "Message references unknown channel " << message.channelId << "\n";
+          return false;
+        }
+        auto& outputMcap = it->second;
+        status = outputMcap.writer->write(message);
+        if (!status.ok()) {
+          std::cerr << "Failed to write message to \"" << outputMcap.filename
+                    << "\": " << status.message << "\n";
+          return false;
+        }
+        return true;
+      }
+      default:
+        // TODO: Write all other Metadata and Attachment records to the index file
+        return true;
+    }
+  };
+
+  // Flush every output and record how far the input has been split. Output data written after
+  // the last checkpoint is truncated away when a killed run is resumed
+  auto saveCheckpoint = [&]() {
+    std::string logEntries;
+    for (auto& [channelId, outputMcap] : outputMcaps) {
+      const auto status = outputMcap.writer->flush();
+      if (!status.ok()) {
+        std::cerr << "Failed to write \"" << outputMcap.filename << "\": " << status.message
+                  << "\n";
+        return false;
+      }
+      AppendLogEntries(channelId, outputMcap, logEntries);
+    }
+    if (!AppendCheckpointLog(checkpointLogFilename, logEntries)) {
+      return false;
+    }
+    checkpoint.logSize += logEntries.size();
+    checkpoint.inputSize = input.size();
+    checkpoint.fingerprint = Fingerprint(input, checkpoint.offset);
+    return SaveCheckpoint(checkpointFilename, ToJson(checkpoint, outputMcaps));
+  };
+
+  // Read the data section from the checkpoint offset. Reading stops at the Data End record, or at
+  // a truncated record at the end of a recording that is still being written
+  mcap::RecordReader reader{input, checkpoint.offset};
+  uint64_t lastCheckpointOffset = checkpoint.offset;
+  std::vector<std::byte> chunkBuffer;
+  while (!(options.interrupt && options.interrupt->load())) {
+    const auto record = reader.next();
+    if (!record || record->opcode == mcap::OpCode::DataEnd ||
+        record->opcode == mcap::OpCode::Footer) {
+      break;
+    }
+
+    if (record->opcode == mcap::OpCode::Chunk) {
+      mcap::Chunk chunk;
+      auto status = mcap::McapReader::ParseChunk(*record, &chunk);
+      const std::byte* records = nullptr;
+      if (status.ok()) {
+        status = DecompressChunk(chunk, chunkBuffer, &records);
+      }
+      bool ok = true;
+      if (status.ok()) {
+        status = ForEachRecord(records, chunk.uncompressedSize,
+                               [&](const mcap::Record& chunkRecord, uint64_t) {
+                                 return ok = handleRecord(chunkRecord);
+                               });
+      }
+      if (!status.ok()) {
+        std::cerr << "Failed to read chunk at offset " << reader.curRecordOffset() << ": "
+                  << status.message << "\n";
+        return false;
+      } else if (!ok) {
+        return false;
+      }
+    } else if (!handleRecord(*record)) {
+      return false;
+    }
 
-  // Read all messages from the input file and write them to the output files
-  for (const auto& msgView : reader.readMessages()) {
-    // Get the output MCAP file for this channel
-    auto& outputMcap = outputMcaps.at(msgView.message.channelId);
+    checkpoint.offset = reader.curRecordOffset() + record->recordSize();
+    if (checkpoint.offset - lastCheckpointOffset >= CheckpointInterval) {
+      if (!saveCheckpoint()) {
+        return false;
+      }
+      lastCheckpointOffset = checkpoint.offset;
+    }
+  }
 
-    // Copy the message and set the channel ID to the output channel ID
-    mcap::Message msg{msgView.message};
-    msg.channelId = outputMcap.channel.id;
+  if (!saveCheckpoint()) {
+    return false;
+  }
 
-    // Write the message to the output file
-    status = outputMcap.writer->write(msg);
+  // Write the summary section of each output. The next run truncates it and appends after the
+  // checkpointed data section
+  mcap::Timestamp startTime = mcap::MaxTime;
+  mcap::Timestamp endTime = 0;
+  for (auto& [channelId, outputMcap] : outputMcaps) {
+    const auto& stats = outputMcap.writer->state().statistics;
+    if (stats.messageCount > 0) {
+      startTime = std::min(startTime, stats.messageStartTime);
+      endTime = std::max(endTime, stats.messageEndTime);
+    }
+  }
+  std::unordered_map<mcap::ChannelId, uint64_t> messageCounts;
+  for (auto& [channelId, outputMcap] : outputMcaps) {
+    messageCounts[channelId] = outputMcap.writer->state().statistics.messageCount;
+    const auto status = outputMcap.writer->close();
     if (!status.ok()) {
-      std::cerr << "Failed to write message to \"" << outputMcap.filename
+      std::cerr << "Failed to close output file \"" << outputMcap.filename
                 << "\": " << status.message << "\n";
       return false;
     }
-
-    outputMcap.messageCount++;
+  }
+  if (startTime > endTime) {
+    startTime = 0;
   }
 
   // Create the index.mcap file containing schemas and channels but no messages
   const auto indexFilename = outputDir + "/index.mcap";
   mcap::McapWriter indexWriter;
-  status = indexWriter.open(indexFilename, mcap::McapWriterOptions{"index"});
+  auto status = indexWriter.open(indexFilename, mcap::McapWriterOptions{"index"});
   if (!status.ok()) {
     std::cerr << "Failed to open index file: " << status.message << "\n";
     return false;
@@ -157,8 +741,8 @@ bool Split(const std::string& inputFilename, const std::string& outputDir) {
   // Write a metadata record to the index file with start and end timestamps
   mcap::Metadata metadata;
   metadata.name = "mcapindex";
-  metadata.metadata["startTime"] = std::to_string(stats.messageStartTime);
-  metadata.metadata["endTime"] = std::to_string(stats.messageEndTime);
+  metadata.metadata["startTime"] = std::to_string(startTime);
+  metadata.metadata["endTime"] = std::to_string(endTime);
   status = indexWriter.write(metadata);
   if (!status.ok()) {
     std::cerr << "Failed to write metadata to index file: " << status.message << "\n";
@@ -167,25 +751,19 @@ bool Split(const std::string& inputFilename, const std::string& outputDir) {
 
   // Write schemas and channels to the index file
   for (const auto& [channelId, outputMcap] : outputMcaps) {
-    auto schema = outputMcap.schema;
-    indexWriter.addSchema(schema);
-
     auto channel = outputMcap.channel;
-    channel.schemaId = schema.id;
+    if (channel.schemaId != 0) {
+      // schema.id is overwritten by McapWriter::addSchema()
+      auto schema = checkpoint.schemas.at(channel.schemaId);
+      indexWriter.addSchema(schema);
+      channel.schemaId = schema.id;
+    }
     channel.metadata["mcapindex:filename"] = outputMcap.filename;
-    channel.metadata["mcapindex:messageCount"] = std::to_string(outputMcap.messageCount);
+    channel.metadata["mcapindex:messageCount"] = std::to_string(messageCounts[channelId]);
     indexWriter.addChannel(channel);
   }
 
-  // TODO: Write all other Metadata and Attachment records to the index file
-
   indexWriter.close();
 
-  // Close all output files
-  for (auto& [channelId, outputMcap] : outputMcaps) {
-    outputMcap.writer->close();
-    outputMcap.writer.reset();
-  }
-
   return true;
 }
@@ -0,0 +1,278 @@
+#include "thin.hpp"
+
+#include <mcap/mcap.hpp>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk.hpp"
+#include "writer.hpp"
+
+// Decimation state of one thinned channel. Messages must be offered in file order
+struct ChannelThinner {
+  std::string topic;
+  uint64_t minInterval = 0;
+  uint64_t every = 1;
+  uint64_t seen = 0;
+  uint64_t kept = 0;
+  mcap::Timestamp lastKept = 0;
+
+  bool keep(mcap::Timestamp logTime) {
+    const uint64_t index = seen++;
+    if (index % every != 0) {
+      return false;
+    } else if (minInterval > 0 && kept > 0 &&
+               (logTime < lastKept || logTime - lastKept < minInterval)) {
+      return false;
+    }
+    lastKept = logTime;
+    kept++;
+    return true;
+  }
+};
+
+bool Thin(const std::string& inputFilename, const std::string& outputFilename,
+          const ThinOptions& options) {
+  mcap::McapReader reader;
+  auto status = reader.open(inputFilename);
+  if (!status.ok()) {
+    spdlog::error("Failed to open input file: {}", status.message);
+    return false;
+  }
+  status = reader.readSummary(mcap::ReadSummaryMethod::AllowFallbackScan);
+  if (!status.ok()) {
+    spdlog::error("Failed to read MCAP summary: {}", status.message);
+    return false;
+  }
+
+  std::unordered_map<mcap::ChannelId, ChannelThinner> thinners;
+  for (const auto& [channelId, channel] : reader.channels()) {
+    const auto rate = options.rates.find(channel->topic);
+    const auto every = options.every.find(channel->topic);
+    if (rate == options.rates.end() && every == options.every.end()) {
+      continue;
+    }
+    ChannelThinner thinner;
+    thinner.topic = channel->topic;
+    if (rate != options.rates.end() && rate->second > 0) {
+      // Rates too low to express in nanoseconds keep only the first message
+      const double interval = 1e9 / rate->second;
+      thinner.minInterval = interval < 1.8e19 ? uint64_t(interval)
+                                              : std::numeric_limits<uint64_t>::max();
+    }
+    if (every != options.every.end()) {
+      thinner.every = std::max(every->second, uint64_t(1));
+    }
+    thinners.emplace(channelId, thinner);
+  }
+  auto warnMissing = [&](const std::string& topic) {
+    for (const auto& [channelId, thinner] : thinners) {
+      if (thinner.topic == topic) {
+        return;
+      }
+    }
+    spdlog::warn("Topic {} not found in {}", topic, inputFilename);
+  };
+  for (const auto& [topic, rate] : options.rates) {
+    warnMissing(topic);
+  }
+  for (const auto& [topic, every] : options.every) {
+    if (options.rates.count(topic) == 0) {
+      warnMissing(topic);
+    }
+  }
+
+  auto chunkIndexes = reader.chunkIndexes();
+  std::sort(chunkIndexes.begin(), chunkIndexes.end(), [](const auto& a, const auto& b) {
+    return a.chunkStartOffset < b.chunkStartOffset;
+  });
+
+  // Rewritten chunks use the compression of the input
+  ChunkedWriterOptions writerOptions;
+  writerOptions.profile = reader.header() ? reader.header()->profile : "";
+  if (!chunkIndexes.empty()) {
+    writerOptions.compression = mcap::McapReader::ParseCompression(chunkIndexes[0].compression)
+                                  .value_or(mcap::Compression::Zstd);
+  }
+  ChunkedWriter writer;
+  status = writer.open(outputFilename, writerOptions);
+  if (!status.ok()) {
+    spdlog::error("Failed to open output file: {}", status.message);
+    return false;
+  }
+  for (const auto& [schemaId, schema] : reader.schemas()) {
+    writer.addSchema(*schema);
+  }
+  for (const auto& [channelId, channel] : reader.channels()) {
+    writer.addChannel(*channel);
+  }
+
+  auto interrupted = [&]() {
+    return options.interrupt && options.interrupt->load();
+  };
+
+  auto writeMessage = [&](const mcap::Message& message) {
+    const auto writeStatus = writer.write(message);
+    if (!writeStatus.ok()) {
+      spdlog::error("Failed to write message: {}", writeStatus.message);
+      return false;
+    }
+    return true;
+  };
+
+  // Parse each message record in `records` and keep it if its channel is not thinned or the
+  // thinner selects it. Used where no message indexes are available
+  auto thinRecords = [&](const std::byte* records, uint64_t size) {
+    bool ok = true;
+    const auto recordsStatus =
+      ForEachRecord(records, size, [&](const mcap::Record& record, uint64_t) {
+        mcap::Message message;
+        if (record.opcode != mcap::OpCode::Message ||
+            !mcap::McapReader::ParseMessage(record, &message).ok()) {
+          return true;
+        }
+        const auto it = thinners.find(message.channelId);
+        if (it == thinners.end() || it->second.keep(message.logTime)) {
+          ok = writeMessage(message);
+        }
+        return ok;
+      });
+    return recordsStatus.ok() && ok;
+  };
+
+  auto* dataSource = reader.dataSource();
+  size_t copiedChunks = 0;
+  size_t rewrittenChunks = 0;
+  size_t skippedChunks = 0;
+  bool ok = true;
+
+  if (chunkIndexes.empty()) {
+    // Unchunked input has no message indexes to select from, so every message is read
+    for (const auto& view : reader.readMessages()) {
+      if (interrupted()) {
+        break;
+      }
+      const auto it = thinners.find(view.message.channelId);
+      if (it == thinners.end() || it->second.keep(view.message.logTime)) {
+        if (!writeMessage(view.message)) {
+          ok = false;
+          break;
+        }
+      }
+    }
+  }
+
+  std::vector<mcap::MessageIndex> messageIndexes;
+  std::vector<uint64_t> keptOffsets;
+  std::vector<std::byte> buffer;
+  for (const auto& chunkIndex : chunkIndexes) {
+    if (!ok || interrupted()) {
+      break;
+    }
+
+    status = ReadMessageIndexes(*dataSource, chunkIndex, messageIndexes);
+    if (!status.ok()) {
+      spdlog::error("Failed to read message indexes of chunk at offset {}: {}",
+                    chunkIndex.chunkStartOffset, status.message);
+      ok = false;
+      break;
+    }
+
+    // Select the messages to keep from the message indexes alone
+    bool thinned = false;
+    keptOffsets.clear();
+    for (const auto& messageIndex : messageIndexes) {
+      const auto it = thinners.find(messageIndex.channelId);
+      thinned = thinned || (it != thinners.end() && !messageIndex.records.empty());
+      for (const auto& [logTime, offset] : messageIndex.records) {
+        if (it == thinners.end() || it->second.keep(logTime)) {
+          keptOffsets.push_back(offset);
+        }
+      }
+    }
+    const bool indexed = !messageIndexes.empty() || chunkIndex.uncompressedSize == 0;
+
+    mcap::Chunk chunk;
+    if (indexed && !thinned) {
+      // Only passthrough topics: copy the compressed chunk and its message indexes unchanged
+      status = ReadChunk(*dataSource, chunkIndex, &chunk);
+      if (status.ok()) {
+        status = writer.writeChunk(chunk, messageIndexes);
+      }
+      if (!status.ok()) {
+        spdlog::error("Failed to copy chunk at offset {}: {}", chunkIndex.chunkStartOffset,
+                      status.message);
+        ok = false;
+      }
+      copiedChunks++;
+      continue;
+    } else if (indexed && keptOffsets.empty()) {
+      skippedChunks++;
+      continue;
+    }
+
+    const std::byte* records = nullptr;
+    status = ReadChunk(*dataSource, chunkIndex, &chunk);
+    if (status.ok()) {
+      status = DecompressChunk(chunk, buffer, &records);
+    }
+    if (!status.ok()) {
+      spdlog::error("Failed to read chunk at offset {}: {}", chunkIndex.chunkStartOffset,
+                    status.message);
+      ok = false;
+      break;
+    }
+    rewrittenChunks++;
+
+    if (!indexed) {
+      // A chunk written without message indexes
+      ok = thinRecords(records, chunk.uncompressedSize);
+      continue;
+    }
+
+    // Write the kept messages in their original order
+    std::sort(keptOffsets.begin(), keptOffsets.end());
+    for (const uint64_t offset : keptOffsets) {
+      mcap::Record record;
+      mcap::Message message;
+      status = RecordAt(records, chunk.uncompressedSize, offset, &record);
+      if (status.ok()) {
+        status = mcap::McapReader::ParseMessage(record, &message);
+      }
+      if (!status.ok()) {
+        spdlog::error("Failed to read message at chunk offset {}: {}", offset, status.message);
+        ok = false;
+        break;
+      } else if (!writeMessage(message)) {
+        ok = false;
+        break;
+      }
+    }
+  }
+
+  // Metadata and attachments are passed through
+  status = CopyMetadataAndAttachments(reader, writer);
+  if (!status.ok()) {
+    spdlog::error("Failed to copy {}", status.message);
+    ok = false;
+  }
+
+  status = writer.close();
+  if (!status.ok()) {
+    spdlog::error("Failed to close output file: {}", status.message);
+    return false;
+  } else if (interrupted()) {
+    spdlog::warn("Interrupted, {} is incomplete", outputFilename);
+    return false;
+  }
+
+  for (const auto& [channelId, thinner] : thinners) {
+    spdlog::info("{}: kept {} of {} messages", thinner.topic, thinner.kept, thinner.seen);
+  }
+  spdlog::info("Copied {} chunks, rewrote {}, skipped {}", copiedChunks, rewrittenChunks,
+               skippedChunks);
+  return ok;
+}
@@ -2,16 +2,25 @@
 
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
+#include <sys/stat.h>
 
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
 #include <optional>
+#include <unistd.h>
 #include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavcodec/bsf.h>
 #include <libavformat/avformat.h>
+#include <libavformat/avio.h>
 }
 
+constexpr int AVIO_BUFFER_SIZE = 64 * 1024;
+
 struct AV1CodecConfigurationRecord {
   uint8_t profile;
   uint8_t level;
@@ -96,19 +105,176 @@ static std::optional<AV1CodecConfigurationRecord> ParseAV1CodecConfigurationReco
   // return true;
 }
 
-std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const std::string& videoFilename) {
-  AVFormatContext* formatCtx = nullptr;
-  if (avformat_open_input(&formatCtx, videoFilename.data(), nullptr, nullptr) != 0) {
+static bool IsAnnexB(const uint8_t* data, size_t size) {
+  return (size >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1) ||
+         (size >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1);
+}
+
+/**
+ * Find the first NAL unit of type `nalType` in an Annex B byte stream and return its payload,
+ * starting with the NAL unit header, with emulation prevention bytes removed. Returns an empty
+ * vector if no matching NAL unit is found.
+ */
+static std::vector<uint8_t> FindAnnexBNalUnit(const uint8_t* data, size_t size, bool hevc,
+                                              uint8_t nalType) {
+  size_t i = 0;
+  while (i + 3 <= size) {
+    if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+      i++;
+      continue;
+    }
+
+    // The NAL unit runs until the next three or four byte start code
+    const size_t start = i + 3;
+    size_t end = start;
+    while (end + 3 <= size &&
+           !(data[end] == 0 && data[end + 1] == 0 && (data[end + 2] == 0 || data[end + 2] == 1))) {
+      end++;
+    }
+    if (end + 3 > size) {
+      end = size;
+    }
+
+    if (start < end) {
+      const uint8_t type = hevc ? uint8_t((data[start] >> 1) & 0x3F) : uint8_t(data[start] & 0x1F);
+      if (type == nalType) {
+        std::vector<uint8_t> rbsp;
+        rbsp.reserve(end - start);
+        size_t zeros = 0;
+        for (size_t j = start; j < end; j++) {
+          if (zeros >= 2 && data[j] == 3) {
+            zeros = 0;
+            continue;
+          }
+          zeros = data[j] == 0 ? zeros + 1 : 0;
+          rbsp.push_back(data[j]);
+        }
+        return rbsp;
+      }
+    }
+    i = end;
+  }
+  return {};
+}
+
+std::unique_ptr<VideoSource> VideoSource::Open(const std::string& videoFilename,
+                                               const std::atomic<bool>* interrupt) {
+  std::unique_ptr<VideoSource> source{new VideoSource()};
+  source->filename_ = videoFilename;
+  source->interrupt_ = interrupt;
+
+  // Regular files are opened by name so libavformat can seek and use the container index. stdin,
+  // FIFOs, sockets and devices are read sequentially through a custom AVIO context
+  bool customIo = videoFilename == "-";
+  if (!customIo) {
+    struct stat st {};
+    customIo = stat(videoFilename.c_str(), &st) == 0 && !S_ISREG(st.st_mode);
+  }
+
+  source->formatCtx_ = avformat_alloc_context();
+  if (!source->formatCtx_) {
+    spdlog::error("avformat_alloc_context() failed for \"{}\"", videoFilename);
+    return {};
+  }
+  source->formatCtx_->interrupt_callback.callback = &VideoSource::CheckInterrupt;
+  source->formatCtx_->interrupt_callback.opaque = source.get();
+
+  if (customIo) {
+    if (videoFilename == "-") {
+      source->fd_ = STDIN_FILENO;
+    } else {
+      // Opening a FIFO blocks until a writer connects
+      source->fd_ = open(videoFilename.c_str(), O_RDONLY | O_CLOEXEC);
+      if (source->fd_ < 0) {
+        spdlog::error("Failed to open \"{}\": {}", videoFilename, std::strerror(errno));
+        return {};
+      }
+      source->ownsFd_ = true;
+    }
+
+    auto* buffer = static_cast<unsigned char*>(av_malloc(AVIO_BUFFER_SIZE));
+    if (buffer) {
+      source->ioCtx_ = avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 0, source.get(),
+                                          &VideoSource::ReadPacket, nullptr, nullptr);
+    }
+    if (!source->ioCtx_) {
+      spdlog::error("avio_alloc_context() failed for \"{}\"", videoFilename);
+      av_free(buffer);
+      return {};
+    }
+    source->ioCtx_->seekable = 0;
+    source->formatCtx_->pb = source->ioCtx_;
+    source->formatCtx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+  }
+
+  // avformat_open_input() frees the context on failure
+  const char* url = customIo ? nullptr : videoFilename.c_str();
+  if (avformat_open_input(&source->formatCtx_, url, nullptr, nullptr) != 0) {
     spdlog::error("Failed to open \"{}\"", videoFilename);
     return {};
   }
 
-  if (avformat_find_stream_info(formatCtx, nullptr) < 0) {
+  if (avformat_find_stream_info(source->formatCtx_, nullptr) < 0) {
     spdlog::error("Failed to find stream info for \"{}\"", videoFilename);
-    avformat_close_input(&formatCtx);
     return {};
   }
 
+  return source;
+}
+
+VideoSource::~VideoSource() {
+  avformat_close_input(&formatCtx_);
+  if (ioCtx_) {
+    av_freep(&ioCtx_->buffer);
+    avio_context_free(&ioCtx_);
+  }
+  if (ownsFd_ && fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+int VideoSource::ReadPacket(void* opaque, uint8_t* buf, int bufSize) {
+  const auto* source = static_cast<const VideoSource*>(opaque);
+  while (true) {
+    const ssize_t n = ::read(source->fd_, buf, size_t(bufSize));
+    if (n > 0) {
+      return int(n);
+    } else if (n == 0) {
+      return AVERROR_EOF;
+    } else if (errno == EINTR) {
+      // A signal interrupted a blocking read. Give up if we were asked to stop, otherwise retry
+      if (source->interrupted()) {
+        return AVERROR_EXIT;
+      }
+    } else {
+      return AVERROR(errno);
+    }
+  }
+}
+
+int VideoSource::CheckInterrupt(void* opaque) {
+  return static_cast<const VideoSource*>(opaque)->interrupted() ? 1 : 0;
+}
+
+std::string VideoSource::formatName() const {
+  return formatCtx_->iformat ? formatCtx_->iformat->name : "";
+}
+
+std::optional<std::string> GetImageFormat(const VideoSource& source) {
+  AVFormatContext* formatCtx = source.formatContext();
+  const int videoStreamIndex =
+    av_find_best_stream(formatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  if (videoStreamIndex >= 0 &&
+      formatCtx->streams[videoStreamIndex]->codecpar->codec_id == AV_CODEC_ID_MJPEG) {
+    return "jpeg";
+  }
+  return {};
+}
+
+std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const VideoSource& source) {
+  const AVFormatContext* formatCtx = source.formatContext();
+  const std::string& videoFilename = source.filename();
+
   int videoStreamIndex = -1;
   for (unsigned int i = 0; i < formatCtx->nb_streams; i++) {
     if (formatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
@@ -123,7 +289,6 @@ std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const std::string& video
     const AVCodecDescriptor* codecDesc = avcodec_descriptor_get(codecParams->codec_id);
     if (!codecDesc) {
       spdlog::error("Failed to get codec descriptor for \"{}\"", videoFilename);
-      avformat_close_input(&formatCtx);
       return {};
     }
 
@@ -136,7 +301,6 @@ std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const std::string& video
     avcodec_free_context(&codecCtx);
     if (hasBFrames) {
       spdlog::error("B-frames are not supported");
-      avformat_close_input(&formatCtx);
       return {};
     }
 
@@ -151,16 +315,31 @@ std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const std::string& video
       // See
       // <https://www.w3.org/TR/webcodecs-hevc-codec-registration/#fully-qualified-codec-strings>
       const uint8_t* extradata = codecParams->extradata;
-      if (codecParams->extradata_size < 23) {
-        spdlog::error("HEVC extradata is too small ({} bytes) for \"{}\"",
-                      codecParams->extradata_size, videoFilename);
-        avformat_close_input(&formatCtx);
+      const size_t extradataSize = size_t(codecParams->extradata_size);
+
+      // MP4 stores a HEVCDecoderConfigurationRecord (hvcC) while MPEG-TS and raw streams carry an
+      // Annex B SPS. In both cases byte 1 holds the tier flag and bytes 2-5 the profile
+      // compatibility flags (the SPS after skipping its two byte NAL unit header)
+      std::vector<uint8_t> sps;
+      const uint8_t* profileTierLevel = nullptr;
+      if (IsAnnexB(extradata, extradataSize)) {
+        sps = FindAnnexBNalUnit(extradata, extradataSize, true, 33);
+        if (sps.size() >= 8) {
+          profileTierLevel = sps.data() + 2;
+        }
+      } else if (extradataSize >= 23) {
+        profileTierLevel = extradata;
+      }
+      if (!profileTierLevel) {
+        spdlog::error("HEVC extradata is too small ({} bytes) for \"{}\"", extradataSize,
+                      videoFilename);
         return {};
       }
 
-      const uint8_t generalTierFlag = (extradata[1] >> 5) & 0x1;
+      const uint8_t generalTierFlag = (profileTierLevel[1] >> 5) & 0x1;
       const uint32_t generalProfileCompatibilityFlags =
-        uint32_t((extradata[2] << 24) | (extradata[3] << 16) | (extradata[4] << 8) | extradata[5]);
+        uint32_t((profileTierLevel[2] << 24) | (profileTierLevel[3] << 16) |
+                 (profileTierLevel[4] << 8) | profileTierLevel[5]);
       const uint8_t compatibilityIdc = (generalProfileCompatibilityFlags >> 16) & 0xFF;
 
       const int profile = codecParams->profile;
@@ -172,7 +351,6 @@ std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const std::string& video
       const std::string codec =
         fmt::format("hev1.{}.{}.{}{}.B{}", profile, compatibility, tier, level, flags);
 
-      avformat_close_input(&formatCtx);
       return VideoDecoderConfig{mime, codec, codedWidth, codedHeight, {}};
     } else if (codecParams->codec_id == AV_CODEC_ID_H264) {
       // H264 codec format is <fourcc>.<profile_idc>.<profile_compatibility>.<level_idc>
@@ -183,20 +361,30 @@ std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const std::string& video
       const uint8_t* extradata = codecParams->extradata;
       const size_t extradataSize = size_t(codecParams->extradata_size);
 
-      if (extradataSize <= 9 || extradata[0] != 1) {
+      // MP4 stores an AVCDecoderConfigurationRecord (avcC) while MPEG-TS and raw streams carry an
+      // Annex B SPS. Both hold profile_idc, profile_compatibility and level_idc in bytes 1-3
+      std::vector<uint8_t> sps;
+      const uint8_t* avcConfig = nullptr;
+      if (IsAnnexB(extradata, extradataSize)) {
+        sps = FindAnnexBNalUnit(extradata, extradataSize, false, 7);
+        if (sps.size() >= 4) {
+          avcConfig = sps.data();
+        }
+      } else if (extradataSize > 9 && extradata[0] == 1) {
+        avcConfig = extradata;
+      }
+      if (!avcConfig) {
         spdlog::error("Error: Invalid H.264 extradata in \"{}\"", videoFilename);
-        avformat_close_input(&formatCtx);
         return {};
       }
 
-      const uint8_t profileIdc = extradata[1];
-      const uint8_t profileCompatibility = extradata[2];
-      const uint8_t levelIdc = extradata[3];
+      const uint8_t profileIdc = avcConfig[1];
+      const uint8_t profileCompatibility = avcConfig[2];
+      const uint8_t levelIdc = avcConfig[3];
       const std::string mime = "video/avc";
       const std::string codec =
         fmt::format("avc1.{:02x}{:02x}{:02x}", profileIdc, profileCompatibility, levelIdc);
 
-      avformat_close_input(&formatCtx);
       return VideoDecoderConfig{mime, codec, codedWidth, codedHeight, {}};
     } else if (codecParams->codec_id == AV_CODEC_ID_AV1) {
       // AV1 codec format is
@@ -213,7 +401,6 @@ std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const std::string& video
       const auto av1Config = ParseAV1CodecConfigurationRecord(extradata, extradataSize);
       if (!av1Config) {
         spdlog::error("Error: Invalid AV1 extradata in \"{}\"", videoFilename);
-        avformat_close_input(&formatCtx);
         return {};
       }
 
@@ -228,30 +415,72 @@ std::optional<VideoDecoderConfig> GetVideoDecoderConfig(const std::string& video
       std::vector<std::byte> description;
       description.assign(extradata, extradata + extradataSize);
 
-      avformat_close_input(&formatCtx);
       return VideoDecoderConfig{mime, codec, codedWidth, codedHeight, description};
     }
   }
 
   spdlog::error("Failed to find compatible video stream in \"{}\"", videoFilename);
-  avformat_close_input(&formatCtx);
   return {};
 }
 
-bool ExtractVideoFrames(const std::string& videoFilename,
-                        std::function<void(const VideoFrame&)> callback) {
-  AVFormatContext* formatCtx = nullptr;
-  if (avformat_open_input(&formatCtx, videoFilename.c_str(), nullptr, nullptr) != 0) {
-    spdlog::error("Failed to open \"{}\"", videoFilename);
-    return false;
+std::vector<VideoRange> GetVideoRanges(const VideoSource& source, uint64_t targetBytes) {
+  AVFormatContext* formatCtx = source.formatContext();
+  if (source.isStream()) {
+    return {};
+  }
+  const int videoStreamIndex =
+    av_find_best_stream(formatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  if (videoStreamIndex < 0) {
+    return {};
   }
 
-  if (avformat_find_stream_info(formatCtx, nullptr) < 0) {
-    spdlog::error("Failed to find stream info for \"{}\"", videoFilename);
-    avformat_close_input(&formatCtx);
-    return false;
+  // Frame numbers are taken from index positions, so the index must list every frame, as MP4
+  // sample tables do. Keyframe-only indexes such as Matroska cues cannot be used
+  AVStream* stream = formatCtx->streams[videoStreamIndex];
+  const int entries = avformat_index_get_entries_count(stream);
+  if (entries < 2 || stream->nb_frames != entries) {
+    return {};
+  }
+
+  std::vector<VideoRange> ranges;
+  uint64_t rangeBytes = 0;
+  int64_t previousTimestamp = INT64_MIN;
+  for (int i = 0; i < entries; i++) {
+    const AVIndexEntry* entry = avformat_index_get_entry(stream, i);
+    // Ranges are delimited by timestamp, which needs strictly increasing decode timestamps
+    if (!entry || entry->timestamp <= previousTimestamp) {
+      return {};
+    }
+    previousTimestamp = entry->timestamp;
+
+    const bool isKeyframe = entry->flags & AVINDEX_KEYFRAME;
+    if (i == 0 && !isKeyframe) {
+      return {};
+    } else if (isKeyframe && (ranges.empty() || rangeBytes >= targetBytes)) {
+      if (!ranges.empty()) {
+        ranges.back().endTimestamp = entry->timestamp;
+      }
+      VideoRange range;
+      range.startTimestamp = entry->timestamp;
+      range.firstFrame = uint32_t(i);
+      ranges.push_back(range);
+      rangeBytes = 0;
+    }
+    ranges.back().frameCount++;
+    rangeBytes += uint64_t(entry->size);
   }
 
+  if (ranges.size() < 2) {
+    return {};
+  }
+  return ranges;
+}
+
+bool ExtractVideoFrames(VideoSource& source, std::function<void(const VideoFrame&)> callback,
+                        const VideoRange* range) {
+  AVFormatContext* formatCtx = source.formatContext();
+  const std::string& videoFilename = source.filename();
+
   const int videoStreamIndex =
     av_find_best_stream(formatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
   if (videoStreamIndex < 0) {
@@ -264,43 +493,70 @@ bool ExtractVideoFrames(const std::string& videoFilename,
 
   AVPacket* packet = av_packet_alloc();
   AVPacket* packetFiltered = av_packet_alloc();
+  AVBSFContext* bsfContext = nullptr;
 
   auto cleanup = [&]() {
-    if (packet->data) av_packet_unref(packet);
-    if (packetFiltered->data) av_packet_unref(packetFiltered);
     av_packet_free(&packet);
     av_packet_free(&packetFiltered);
-    avformat_close_input(&formatCtx);
+    av_bsf_free(&bsfContext);
   };
 
-  if (codecId == AV_CODEC_ID_HEVC || codecId == AV_CODEC_ID_H264) {
-    // Construct a bitstream filter to convert the H.264/HEVC stream to Annex B format
+  if (codecId == AV_CODEC_ID_HEVC || codecId == AV_CODEC_ID_H264 || codecId == AV_CODEC_ID_MJPEG) {
+    // Construct a bitstream filter to convert the H.264/HEVC stream to Annex B format. Streams that
+    // are already Annex B (MPEG-TS, raw elementary streams) pass through unchanged. MJPEG packets
+    // are complete JPEG images and go through the "null" filter
     // FIXME: Try writing `avc` bitstream instead of Annex B format
-    const AVBitStreamFilter* bitstreamFilter =
-      av_bsf_get_by_name(codecId == AV_CODEC_ID_HEVC ? "hevc_mp4toannexb" : "h264_mp4toannexb");
+    const char* filterName = codecId == AV_CODEC_ID_HEVC   ? "hevc_mp4toannexb"
+                             : codecId == AV_CODEC_ID_H264 ? "h264_mp4toannexb"
+                                                           : "null";
+    const AVBitStreamFilter* bitstreamFilter = av_bsf_get_by_name(filterName);
     if (!bitstreamFilter) {
       spdlog::error("av_bsf_get_by_name() failed for \"{}\"", videoFilename);
       cleanup();
       return false;
     }
-    AVBSFContext* bsfContext = nullptr;
+    // Every call, and so every range of a parallel conversion, gets a fresh bitstream filter, which
+    // inserts parameter sets before its first keyframe just as a sequential pass does for every
+    // keyframe that follows delta frames
     if (av_bsf_alloc(bitstreamFilter, &bsfContext) < 0) {
       spdlog::error("av_bsf_alloc() failed for \"{}\"", videoFilename);
       cleanup();
       return false;
     }
-    bsfContext->par_in = stream->codecpar;
+    // The filter owns `par_in`, so copy the stream parameters rather than sharing them
+    if (avcodec_parameters_copy(bsfContext->par_in, stream->codecpar) < 0) {
+      spdlog::error("avcodec_parameters_copy() failed for \"{}\"", videoFilename);
+      cleanup();
+      return false;
+    }
+    bsfContext->time_base_in = stream->time_base;
     if (av_bsf_init(bsfContext) < 0) {
       spdlog::error("av_bsf_init() failed for \"{}\"", videoFilename);
       cleanup();
       return false;
     }
 
+    // Seek to the keyframe at or before the start of the range. Packets before the range are
+    // skipped below
+    if (range && av_seek_frame(formatCtx, videoStreamIndex, range->startTimestamp,
+                               AVSEEK_FLAG_BACKWARD) < 0) {
+      spdlog::error("Failed to seek to timestamp {} in \"{}\"", range->startTimestamp,
+                    videoFilename);
+      cleanup();
+      return false;
+    }
+
     // Process all packets in the video file
     while (true) {
       if (packet->data) av_packet_unref(packet);
       if (packetFiltered->data) av_packet_unref(packetFiltered);
 
+      if (source.interrupted()) {
+        spdlog::info("Interrupted, stopping extraction from \"{}\"", videoFilename);
+        cleanup();
+        return true;
+      }
+
       // Read packets until we find a packet from the relevant stream
       int err = 0;
       while ((err = av_read_frame(formatCtx, packet)) >= 0 &&
@@ -308,28 +564,37 @@ bool ExtractVideoFrames(const std::string& videoFilename,
         av_packet_unref(packet);
       }
 
-      // Check if an expected (EOF) or unexpected error occurred
+      // Check if an expected (EOF or interrupt) or unexpected error occurred
       if (err < 0) {
         const int64_t packetPos = packet->pos;
-        if (packet->data) av_packet_unref(packet);
-        if (packetFiltered->data) av_packet_unref(packetFiltered);
-        avformat_close_input(&formatCtx);
+        cleanup();
 
-        if (err != AVERROR_EOF) {
+        if (err == AVERROR_EXIT) {
+          spdlog::info("Interrupted, stopping extraction from \"{}\"", videoFilename);
+          return true;
+        } else if (err != AVERROR_EOF) {
           // Unexpected error
           char errStr[128] = {};
           av_strerror(err, errStr, sizeof(errStr));
           spdlog::error("av_read_frame() failed at position {} in \"{}\": {}", packetPos,
                         videoFilename, errStr);
-          cleanup();
           return false;
         }
 
         // End of file reached
-        cleanup();
         return true;
       }
 
+      if (range) {
+        const int64_t dts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+        if (dts >= range->endTimestamp) {
+          cleanup();
+          return true;
+        } else if (dts < range->startTimestamp) {
+          continue;
+        }
+      }
+
       // Send the packet to the bitstream filter
       if (av_bsf_send_packet(bsfContext, packet) < 0) {
         spdlog::error("av_bsf_send_packet() failed for \"{}\"", videoFilename);
@@ -350,12 +615,14 @@ bool ExtractVideoFrames(const std::string& videoFilename,
         }
 
         if (recvStatus >= 0) {
-          // A filtered packet was produced, construct a VideoFrame and fire the callback
+          // A filtered packet was produced, construct a VideoFrame and fire the callback. Raw
+          // streams may lack presentation timestamps, in which case the decode timestamp is used
+          const int64_t pts =
+            packetFiltered->pts != AV_NOPTS_VALUE ? packetFiltered->pts : packetFiltered->dts;
           VideoFrame frame;
           frame.data = reinterpret_cast<const std::byte*>(packetFiltered->data);
           frame.size = size_t(packetFiltered->size);
-          frame.timestamp =
-            uint64_t(double(packetFiltered->pts) * av_q2d(stream->time_base) * 1e9);  // [ns]
+          frame.timestamp = uint64_t(double(pts) * av_q2d(stream->time_base) * 1e9);  // [ns]
           frame.isKeyframe = packetFiltered->flags & AV_PKT_FLAG_KEY;
           callback(frame);
         }
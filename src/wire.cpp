@@ -0,0 +1,57 @@
+#include "wire.hpp"
+
+using google::protobuf::FieldDescriptor;
+
+WireType WireTypeOf(const FieldDescriptor* field) {
+  switch (field->type()) {
+    case FieldDescriptor::TYPE_DOUBLE:
+    case FieldDescriptor::TYPE_FIXED64:
+    case FieldDescriptor::TYPE_SFIXED64:
+      return WireType::Fixed64;
+    case FieldDescriptor::TYPE_FLOAT:
+    case FieldDescriptor::TYPE_FIXED32:
+    case FieldDescriptor::TYPE_SFIXED32:
+      return WireType::Fixed32;
+    case FieldDescriptor::TYPE_STRING:
+    case FieldDescriptor::TYPE_BYTES:
+    case FieldDescriptor::TYPE_MESSAGE:
+      return WireType::LengthDelimited;
+    case FieldDescriptor::TYPE_GROUP:
+      return WireType::StartGroup;
+    default:
+      return WireType::Varint;
+  }
+}
+
+uint64_t ScalarDefault(const FieldDescriptor* field) {
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      return uint64_t(int64_t(field->default_value_int32()));
+    case FieldDescriptor::CPPTYPE_INT64:
+      return uint64_t(field->default_value_int64());
+    case FieldDescriptor::CPPTYPE_UINT32:
+      return field->default_value_uint32();
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return field->default_value_uint64();
+    case FieldDescriptor::CPPTYPE_FLOAT: {
+      const float value = field->default_value_float();
+      uint32_t bits = 0;
+      std::memcpy(&bits, &value, sizeof(value));
+      return bits;
+    }
+    case FieldDescriptor::CPPTYPE_DOUBLE: {
+      const double value = field->default_value_double();
+      uint64_t bits = 0;
+      std::memcpy(&bits, &value, sizeof(value));
+      return bits;
+    }
+    case FieldDescriptor::CPPTYPE_BOOL:
+      return field->default_value_bool() ? 1 : 0;
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return field->default_value_enum()
+               ? uint64_t(int64_t(field->default_value_enum()->number()))
+               : 0;
+    default:
+      return 0;
+  }
+}
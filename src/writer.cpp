@@ -0,0 +1,425 @@
+#include "writer.hpp"
+
+#include "chunk.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+
+class ChunkedWriter::FileSink final : public mcap::IWritable {
+public:
+  FileSink(std::FILE* file, uint64_t offset)
+      : file_(file)
+      , size_(offset) {}
+
+  ~FileSink() override {
+    end();
+  }
+
+  void handleWrite(const std::byte* data, uint64_t size) override {
+    if (std::fwrite(data, 1, size, file_) != size) {
+      failed_ = true;
+    }
+    size_ += size;
+  }
+
+  void end() override {
+    if (file_) {
+      if (std::fclose(file_) != 0) {
+        failed_ = true;
+      }
+      file_ = nullptr;
+    }
+  }
+
+  uint64_t size() const override {
+    return size_;
+  }
+
+  bool flush() {
+    return file_ && std::fflush(file_) == 0 && !failed_;
+  }
+
+  bool failed() const {
+    return failed_;
+  }
+
+private:
+  std::FILE* file_;
+  uint64_t size_;
+  bool failed_ = false;
+};
+
+class ChunkedWriter::BufferSink final : public mcap::IWritable {
+public:
+  void handleWrite(const std::byte* data, uint64_t size) override {
+    buffer_.insert(buffer_.end(), data, data + size);
+  }
+
+  void end() override {}
+
+  uint64_t size() const override {
+    return buffer_.size();
+  }
+
+  const std::byte* data() const {
+    return buffer_.data();
+  }
+
+  void clear() {
+    buffer_.clear();
+    resetCrc();
+  }
+
+private:
+  std::vector<std::byte> buffer_;
+};
+
+ChunkedWriter::ChunkedWriter()
+    : chunkBuffer_(std::make_unique<BufferSink>()) {
+  chunkBuffer_->crcEnabled = true;
+}
+
+ChunkedWriter::~ChunkedWriter() = default;
+
+mcap::Status ChunkedWriter::open(const std::string& filename, const ChunkedWriterOptions& options) {
+  std::FILE* file = std::fopen(filename.c_str(), "wb");
+  if (!file) {
+    return mcap::Status{mcap::StatusCode::OpenFailed, "failed to create \"" + filename + "\""};
+  }
+
+  filename_ = filename;
+  options_ = options;
+  state_ = ChunkedWriterState{};
+  file_ = std::make_unique<FileSink>(file, 0);
+
+  mcap::McapWriter::writeMagic(*file_);
+  mcap::McapWriter::write(*file_, mcap::Header{options_.profile, "mcaptool"});
+  state_.dataEnd = file_->size();
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status ChunkedWriter::resume(const std::string& filename,
+                                   const ChunkedWriterOptions& options,
+                                   const ChunkedWriterState& state) {
+  std::error_code ec;
+  const auto fileSize = std::filesystem::file_size(filename, ec);
+  if (ec || fileSize < state.dataEnd) {
+    return mcap::Status{mcap::StatusCode::OpenFailed,
+                        "\"" + filename + "\" is shorter than its recorded data section"};
+  }
+  std::filesystem::resize_file(filename, state.dataEnd, ec);
+  if (ec) {
+    return mcap::Status{mcap::StatusCode::OpenFailed,
+                        "failed to truncate \"" + filename + "\": " + ec.message()};
+  }
+
+  std::FILE* file = std::fopen(filename.c_str(), "r+b");
+  if (!file || std::fseek(file, 0, SEEK_END) != 0) {
+    if (file) {
+      std::fclose(file);
+    }
+    return mcap::Status{mcap::StatusCode::OpenFailed, "failed to reopen \"" + filename + "\""};
+  }
+
+  filename_ = filename;
+  options_ = options;
+  state_ = state;
+  file_ = std::make_unique<FileSink>(file, state.dataEnd);
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+void ChunkedWriter::addSchema(const mcap::Schema& schema) {
+  if (!file_ || state_.schemas.count(schema.id) > 0) {
+    return;
+  }
+  mcap::McapWriter::write(*file_, schema);
+  state_.schemas.emplace(schema.id, schema);
+  state_.statistics.schemaCount++;
+  state_.dataEnd = file_->size();
+}
+
+void ChunkedWriter::addChannel(const mcap::Channel& channel) {
+  if (!file_ || state_.channels.count(channel.id) > 0) {
+    return;
+  }
+  mcap::McapWriter::write(*file_, channel);
+  state_.channels.emplace(channel.id, channel);
+  state_.statistics.channelCount++;
+  state_.dataEnd = file_->size();
+}
+
+void ChunkedWriter::recordMessageTimes(mcap::Timestamp startTime, mcap::Timestamp endTime) {
+  auto& stats = state_.statistics;
+  if (stats.messageCount == 0 || startTime < stats.messageStartTime) {
+    stats.messageStartTime = startTime;
+  }
+  if (stats.messageCount == 0 || endTime > stats.messageEndTime) {
+    stats.messageEndTime = endTime;
+  }
+}
+
+mcap::Status ChunkedWriter::write(const mcap::Message& message) {
+  if (!file_) {
+    return mcap::Status{mcap::StatusCode::NotOpen};
+  }
+
+  if (chunkBuffer_->size() == 0) {
+    chunkStartTime_ = message.logTime;
+    chunkEndTime_ = message.logTime;
+  } else {
+    chunkStartTime_ = std::min(chunkStartTime_, message.logTime);
+    chunkEndTime_ = std::max(chunkEndTime_, message.logTime);
+  }
+
+  auto& index = chunkMessageIndexes_[message.channelId];
+  index.channelId = message.channelId;
+  index.records.emplace_back(message.logTime, chunkBuffer_->size());
+  mcap::McapWriter::write(*chunkBuffer_, message);
+
+  recordMessageTimes(message.logTime, message.logTime);
+  state_.statistics.messageCount++;
+  state_.statistics.channelMessageCounts[message.channelId]++;
+
+  if (chunkBuffer_->size() >= options_.chunkSize) {
+    return closeChunk();
+  }
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status ChunkedWriter::write(const mcap::Metadata& metadata) {
+  if (!file_) {
+    return mcap::Status{mcap::StatusCode::NotOpen};
+  }
+  mcap::MetadataIndex index;
+  index.offset = file_->size();
+  index.length = mcap::McapWriter::write(*file_, metadata);
+  index.name = metadata.name;
+  state_.metadataIndexes.push_back(index);
+  state_.statistics.metadataCount++;
+  state_.dataEnd = file_->size();
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status ChunkedWriter::write(const mcap::Attachment& attachment) {
+  if (!file_) {
+    return mcap::Status{mcap::StatusCode::NotOpen};
+  }
+  mcap::AttachmentIndex index;
+  index.offset = file_->size();
+  index.length = mcap::McapWriter::write(*file_, attachment);
+  index.logTime = attachment.logTime;
+  index.createTime = attachment.createTime;
+  index.dataSize = attachment.dataSize;
+  index.name = attachment.name;
+  index.mediaType = attachment.mediaType;
+  state_.attachmentIndexes.push_back(index);
+  state_.statistics.attachmentCount++;
+  state_.dataEnd = file_->size();
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status ChunkedWriter::writeChunk(const mcap::Chunk& chunk,
+                                       const std::vector<mcap::MessageIndex>& messageIndexes) {
+  if (!file_) {
+    return mcap::Status{mcap::StatusCode::NotOpen};
+  }
+  auto status = closeChunk();
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto& stats = state_.statistics;
+  uint64_t messageCount = 0;
+  for (const auto& index : messageIndexes) {
+    messageCount += index.records.size();
+  }
+  if (messageCount > 0) {
+    recordMessageTimes(chunk.messageStartTime, chunk.messageEndTime);
+  }
+  stats.messageCount += messageCount;
+  for (const auto& index : messageIndexes) {
+    if (!index.records.empty()) {
+      stats.channelMessageCounts[index.channelId] += index.records.size();
+    }
+  }
+  return writeChunkRecords(chunk, messageIndexes);
+}
+
+mcap::Status ChunkedWriter::writeChunkRecords(
+  const mcap::Chunk& chunk, const std::vector<mcap::MessageIndex>& messageIndexes) {
+  mcap::ChunkIndex chunkIndex;
+  chunkIndex.messageStartTime = chunk.messageStartTime;
+  chunkIndex.messageEndTime = chunk.messageEndTime;
+  chunkIndex.chunkStartOffset = file_->size();
+  chunkIndex.chunkLength = mcap::McapWriter::write(*file_, chunk);
+  chunkIndex.compression = chunk.compression;
+  chunkIndex.compressedSize = chunk.compressedSize;
+  chunkIndex.uncompressedSize = chunk.uncompressedSize;
+
+  const uint64_t messageIndexStart = file_->size();
+  for (const auto& index : messageIndexes) {
+    chunkIndex.messageIndexOffsets[index.channelId] = file_->size();
+    mcap::McapWriter::write(*file_, index);
+  }
+  chunkIndex.messageIndexLength = file_->size() - messageIndexStart;
+
+  state_.chunkIndexes.push_back(std::move(chunkIndex));
+  state_.statistics.chunkCount++;
+  state_.dataEnd = file_->size();
+
+  if (file_->failed()) {
+    return mcap::Status{mcap::StatusCode::OpenFailed, "failed to write to \"" + filename_ + "\""};
+  }
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status ChunkedWriter::closeChunk() {
+  if (!file_ || chunkBuffer_->size() == 0) {
+    return mcap::Status{mcap::StatusCode::Success};
+  }
+
+  mcap::Chunk chunk;
+  chunk.messageStartTime = chunkStartTime_;
+  chunk.messageEndTime = chunkEndTime_;
+  chunk.uncompressedSize = chunkBuffer_->size();
+  chunk.uncompressedCrc = chunkBuffer_->crc();
+  chunk.compression = CompressionName(options_.compression);
+  if (chunk.compression.empty()) {
+    chunk.compressedSize = chunkBuffer_->size();
+    chunk.records = chunkBuffer_->data();
+  } else {
+    const auto status = CompressChunk(chunk.compression, options_.compressionLevel,
+                                      chunkBuffer_->data(), chunkBuffer_->size(),
+                                      compressedBuffer_);
+    if (!status.ok()) {
+      return status;
+    }
+    chunk.compressedSize = compressedBuffer_.size();
+    chunk.records = compressedBuffer_.data();
+  }
+
+  std::vector<mcap::MessageIndex> messageIndexes;
+  messageIndexes.reserve(chunkMessageIndexes_.size());
+  for (auto& [channelId, index] : chunkMessageIndexes_) {
+    messageIndexes.push_back(std::move(index));
+  }
+  chunkMessageIndexes_.clear();
+
+  const auto status = writeChunkRecords(chunk, messageIndexes);
+  chunkBuffer_->clear();
+  return status;
+}
+
+mcap::Status ChunkedWriter::flush() {
+  auto status = closeChunk();
+  if (!status.ok()) {
+    return status;
+  }
+  if (file_ && !file_->flush()) {
+    return mcap::Status{mcap::StatusCode::OpenFailed, "failed to flush \"" + filename_ + "\""};
+  }
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status ChunkedWriter::close() {
+  if (!file_) {
+    return mcap::Status{mcap::StatusCode::NotOpen};
+  }
+  auto status = closeChunk();
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto& out = *file_;
+  mcap::McapWriter::write(out, mcap::DataEnd{0});
+
+  // Summary section: one group per record type, each located by a summary offset record
+  const uint64_t summaryStart = out.size();
+  std::vector<mcap::SummaryOffset> summaryOffsets;
+  auto writeGroup = [&](mcap::OpCode opcode, auto&& writeRecords) {
+    const uint64_t groupStart = out.size();
+    writeRecords();
+    if (out.size() > groupStart) {
+      summaryOffsets.push_back(mcap::SummaryOffset{opcode, groupStart, out.size() - groupStart});
+    }
+  };
+  writeGroup(mcap::OpCode::Schema, [&] {
+    for (const auto& [schemaId, schema] : state_.schemas) {
+      mcap::McapWriter::write(out, schema);
+    }
+  });
+  writeGroup(mcap::OpCode::Channel, [&] {
+    for (const auto& [channelId, channel] : state_.channels) {
+      mcap::McapWriter::write(out, channel);
+    }
+  });
+  writeGroup(mcap::OpCode::Statistics, [&] {
+    mcap::McapWriter::write(out, state_.statistics);
+  });
+  writeGroup(mcap::OpCode::ChunkIndex, [&] {
+    for (const auto& chunkIndex : state_.chunkIndexes) {
+      mcap::McapWriter::write(out, chunkIndex);
+    }
+  });
+  writeGroup(mcap::OpCode::AttachmentIndex, [&] {
+    for (const auto& attachmentIndex : state_.attachmentIndexes) {
+      mcap::McapWriter::write(out, attachmentIndex);
+    }
+  });
+  writeGroup(mcap::OpCode::MetadataIndex, [&] {
+    for (const auto& metadataIndex : state_.metadataIndexes) {
+      mcap::McapWriter::write(out, metadataIndex);
+    }
+  });
+
+  const uint64_t summaryOffsetStart = out.size();
+  for (const auto& summaryOffset : summaryOffsets) {
+    mcap::McapWriter::write(out, summaryOffset);
+  }
+
+  mcap::McapWriter::write(out, mcap::Footer{summaryStart, summaryOffsetStart, 0}, false);
+  mcap::McapWriter::writeMagic(out);
+
+  const bool failed = !out.flush();
+  out.end();
+  file_.reset();
+  if (failed) {
+    return mcap::Status{mcap::StatusCode::OpenFailed, "failed to write \"" + filename_ + "\""};
+  }
+  return mcap::Status{mcap::StatusCode::Success};
+}
+
+mcap::Status CopyMetadataAndAttachments(mcap::McapReader& reader, ChunkedWriter& writer) {
+  auto* dataSource = reader.dataSource();
+  for (const auto& [name, metadataIndex] : reader.metadataIndexes()) {
+    mcap::Record record;
+    mcap::Metadata metadata;
+    auto status = mcap::McapReader::ReadRecord(*dataSource, metadataIndex.offset, &record);
+    if (status.ok()) {
+      status = mcap::McapReader::ParseMetadata(record, &metadata);
+    }
+    if (status.ok()) {
+      status = writer.write(metadata);
+    }
+    if (!status.ok()) {
+      return mcap::Status{status.code, "metadata \"" + name + "\": " + status.message};
+    }
+  }
+  for (const auto& [name, attachmentIndex] : reader.attachmentIndexes()) {
+    mcap::Record record;
+    mcap::Attachment attachment;
+    auto status = mcap::McapReader::ReadRecord(*dataSource, attachmentIndex.offset, &record);
+    if (status.ok()) {
+      status = mcap::McapReader::ParseAttachment(record, &attachment);
+    }
+    if (status.ok()) {
+      status = writer.write(attachment);
+    }
+    if (!status.ok()) {
+      return mcap::Status{status.code, "attachment \"" + name + "\": " + status.message};
+    }
+  }
+  return mcap::Status{mcap::StatusCode::Success};
+}